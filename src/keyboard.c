@@ -15,11 +15,11 @@
 //      in some aspects and I plan to improve this primarily in a version 2 of this keyboard project with what I have learned.
 //
 //  It is very important either a 12 or 24 MHz crystal oscilliator is used to drive the MCU! The code will need to be modified to maintain accurate timing for any other clock speed!
-//      It is strongly advised a 24 MHz system clock is utilized, as a 12 MHz system clock causes the transmit function to drop its speed below the PS/2 protocol specification.
+//      It is strongly advised a 24 MHz system clock is utilized, as a 12 MHz system clock leaves the transmit function little margin inside each timed half of a clock pulse.
 //
 //  The PS/2 protocol specification I read states the clock frequency must be within 10 - 16.7 kHz (testing a real keyboard agrees, but some sources claim different ranges).
-//      With a 24 MHz system clock, the clock frequency is programmed at 11.9 kHz (but can be modified faster than spec at a max of 17.2 kHz).
-//      With a 12 MHz system clock, the clock frequency will drop as low as 7.5 kHz (but can be modified just below spec at a max of 9.8 kHz).
+//      The clock frequency is programmed at 15.6 kHz, falling back to 11.9 and 10.2 kHz on a troubled link (see LINK_SPEEDS), with either system clock.
+//      (Version 1.0 timed each clock pulse with delay_us() on top of its call overhead, giving 11.9 kHz at 24 MHz and as low as 7.5 kHz at 12 MHz.)
 //
 //  Though in my own observations, the keyboard appeared to work just fine with the host even with its clock frequency as low as 7.5 kHz, despite being below the specification.
 //      I am not sure if this is just the case with the host hardware I've tested it on, or if hosts are generally receptive and robust with out-of-spec keyboards.
@@ -31,58 +31,958 @@
 
 // definitions
 #define CLOCK 24    // the clock speed in MHz driving XTAL1 & XTAL2
+
+// core speed, the oscillator clocks per machine cycle: 12 for a standard 8051/8052, 6 for X2 mode parts (such as the AT89C51RC2/RD2 with X2 set), or 1 for single-cycle cores
+//      (such as the DS89C4x0 or STC 1T parts, whose instructions take 1 - 4 clocks rather than exactly 1, so check their PS/2 clock on a scope)
+//      X2 mode doubles the timers along with the core, while single-cycle cores keep their timers counting every 12 clocks by default (a 10ms interval would not fit
+//      Timer 2 otherwise), so every timer count below is in CLOCKS_PER_COUNT clocks (the PS/2 clock pulses included, see HALF_RELOAD())
+#define CLOCKS_PER_CYCLE 12
+#if CLOCKS_PER_CYCLE == 1
+#define CLOCKS_PER_COUNT 12
+#else
+#define CLOCKS_PER_COUNT CLOCKS_PER_CYCLE
+#endif
+#define COUNTS_PER_US (CLOCK / CLOCKS_PER_COUNT) // timer counts per microsecond (1, 2 or 4)
+
+// performance profile, 0 for the default profile or 1 for the low-latency gaming profile, which gives up some power, link margin and host leeway for press-to-host latency:
+//      eager debounce (a change is sent on its first edge and the key then ignored while its contacts settle) instead of waiting for a change to read the same twice,
+//      a fastest link speed pushed right up to the 16.7 kHz limit, 100us between bytes instead of 336us, presses sent ahead of queued releases (other than modifier releases), no idle back-off,
+//      and a 30us column settle instead of 100us (calibrate COLUMN_SETTLE down to the lowest value that shows no ghost key-presses in the bottom row)
+#define GAMING 0
+#if GAMING
+#define BREAK 100   // the period between keycode/byte transmissions (in particular for extended/release codes, or multiple argument byte transmissions in a row)
+#define COLUMN_SETTLE 30 // the delay after driving a column before reading its rows
+#else
 #define BREAK 336   // the period between keycode/byte transmissions (in particular for extended/release codes, or multiple argument byte transmissions in a row)
-#define EXT 0x02E0  // extension keycode with stop/parity
-#define REL 0x03F0  // release keycode with stop/parity
+#define COLUMN_SETTLE 100 // the delay after driving a column before reading its rows
+#endif
+#define BREAK_COUNTS (BREAK * COUNTS_PER_US) // the BREAK period in Timer 2 counts, for timing it against the last byte sent rather than with a blocking delay
+#define INHIBIT_GAP_COUNTS (50 * COUNTS_PER_US) // the 50us the host must have released the clock for before the device may transmit, in Timer 2 counts
 #define ACK 0x03FA  // acknowledge command with stop/parity
 #define RE  0x02FE  // resend command with stop/parity
 #define NA  0x0300  // NA/error command with stop/parity (unused, experimental)
+#define DEFAULT_REPEAT_RATE 50   // the power-on typematic rate (see REPEAT_RATE)
+#define DEFAULT_REPEAT_DELAY 100 // the power-on typematic delay (see REPEAT_DELAY)
+#define BAT 0x03AA  // basic assurance test passed with stop/parity
+#define BAT_DELAY 50 // 10ms intervals from power-on before BAT is reported, the PS/2 protocol expects the test to complete 500 - 750ms after power-on
+                     //      (hosts generally accept it sooner, so lowering this shortens boot-to-typing time accordingly)
+
+// PS/2 clock pulse timing, each half-period of a clock pulse sent or received is timed by Timer 0, run in 8-bit auto-reload mode through the bit loops of transmit() and
+//      receive() so that its overflow flag sets once every half-period however long the code in between takes. Every clock edge is made by EDGE_LOW() or EDGE_HIGH(),
+//      which poll the flag with a JNB on itself (2 machine cycles), clear it and switch the clock line (1 machine cycle each), so each edge follows its overflow by the
+//      same 2 - 4 machine cycles and the half-periods match the timer to within the 2 cycles of the poll (1us at 24 MHz, 0.5us in X2 mode, 2us at 12 MHz). The rest of
+//      each bit (the inhibit check, setting the data bit, sampling it, the loop) only has to fit inside a half-period, which it does by a wide margin.
+//      NOTE: these figures follow from the 8051 instruction timings of the edge code written out here rather than from a compiler listing or a scope, so they hold
+//      whatever code the compiler makes of the rest of the loop (single-cycle cores take 1 - 4 clocks an instruction, so their edges follow even sooner)
+#define HALF_RELOAD(us) (256 - (us) * COUNTS_PER_US) // Timer 0 reload for a half-period of us microseconds (us * COUNTS_PER_US must stay below 256)
+#define EDGE_LOW()  __asm__("\tjnb\t_TF0,.\n\tclr\t_TF0\n\tclr\t_P2_1")  // waits out the half-period under way, then lowers the clock
+#define EDGE_HIGH() __asm__("\tjnb\t_TF0,.\n\tclr\t_TF0\n\tsetb\t_P2_1") // waits out the half-period under way, then raises the clock
+#define EDGE_WAIT() __asm__("\tjnb\t_TF0,.\n\tclr\t_TF0")                 // waits out the half-period under way
+
+// adaptive link speed, the device-to-host clock starts at the fastest speed and falls back one speed whenever the host asks for more than LINK_ERROR_LIMIT resends
+//      (0xFE) or inhibits more than that many transmissions part way through within LINK_WINDOW 10ms intervals. A speed is the half-period of its clock pulses (the
+//      downtime and uptime being equal): 32us gives 15.6 kHz, 42us 11.9 kHz as in version 1.0, and 49us 10.2 kHz, all within the 10 - 16.7 kHz the protocol specifies
+//      (and its 30 - 50us for either half). The table holds the Timer 0 reloads making those half-periods (see HALF_RELOAD()).
+#define LINK_SPEEDS 3
+#define LINK_WINDOW 100    // 1s windows for counting link errors (must stay below 128 as ELAPSED_TIME wraps at 128)
+#define LINK_ERROR_LIMIT 4 // link errors tolerated per window before falling back to a slower speed
+#if GAMING
+__code unsigned char LINK_HALF_TIMES[LINK_SPEEDS] = { HALF_RELOAD(31), HALF_RELOAD(42), HALF_RELOAD(49) }; // the gaming profile's fastest speed is 16.1 kHz (31us leaving the poll's 1us of jitter inside the 30us minimum)
+#else
+__code unsigned char LINK_HALF_TIMES[LINK_SPEEDS] = { HALF_RELOAD(32), HALF_RELOAD(42), HALF_RELOAD(49) };
+#endif
+#define RECEIVE_HALF HALF_RELOAD(40) // the 40us half-periods of each clock pulse while receiving from the host (12.5 kHz)
+#define RECEIVE_TIMEOUT 10 // 10ms intervals to wait for the host to start sending a byte before giving up on it (an argument a command promised but never sent)
+
+// per-key attributes set by the scan code set 3 commands 0xF7 - 0xFD, as bits turning a behavior off (so none set is the default of typematic/make/release)
+//      0xF6 - 0xFA set KEY_ATTRIBUTES_ALL for every key, and the keys named one by one with 0xFB - 0xFD get a slot each with their own, as hosts name only a few keys
+//      (a bitmap per attribute covering every key would take 28 bytes of RAM that are all clear unless the host uses set 3 at all)
+//      NOTE: a key named with every slot taken is acknowledged but keeps the attributes of all keys
+#define KEY_NO_BREAK  0x01 // the key sends no break codes (set 3 typematic only and make only keys)
+#define KEY_NO_REPEAT 0x02 // the key never repeats (set 3 make/release and make only keys)
+#define KEY_ATTRIBUTE_SLOTS 4
+
+// outgoing key events are queued as one byte each, the key identifier in bits 0-6 and bit 7 set for a release
+//      the queue only has to cover the events the link has yet to catch up with, a change finding it full is simply picked up again on the next pass (see queueEvent())
+#define EVENT_QUEUE_SIZE 8 // must be a power of 2 (holding one event less, so 7 events)
+#define EVENT_BREAK 0x80
+
+// adaptive scan rate (both in units of Timer 2's 10ms intervals, and both must stay below 128 as ELAPSED_TIME wraps at 128)
+//      while any key is held or has changed within the last IDLE_TIMEOUT intervals, the key-matrix is scanned back to back (a full pass takes roughly 1.6ms)
+//      once idle, a pass is only started every IDLE_PERIOD intervals, which drops scanning to roughly 5% of CPU time (1.6ms per 30ms) at the cost of up to 30ms extra latency on the first keypress
+//      lowering IDLE_PERIOD trades idle CPU time for first-keypress latency, raising IDLE_TIMEOUT keeps the keyboard in its fast mode longer after typing stops
+#define IDLE_TIMEOUT 100 // 1s of inactivity before backing off to the idle scan rate
+#define IDLE_PERIOD  3   // 30ms between scan passes while idle
+
+// Timer 2 counts every CLOCKS_PER_COUNT clocks, so one 10ms interval is CLOCK * 10000 / CLOCKS_PER_COUNT counts (10000 at 12 MHz, 20000 at 24 MHz, 40000 at 24 MHz in X2 mode)
+#define TICK_COUNTS (CLOCK * 10000UL / CLOCKS_PER_COUNT)
+#define TIMER2_RELOAD (0x10000UL - TICK_COUNTS) // Timer 2 counts up from here to its overflow every 10ms
+#define SETTLE_COUNTS (COLUMN_SETTLE * COUNTS_PER_US) // the column settle in Timer 2 counts, for timing it as a deadline rather than with a blocking delay
+#define SLEEP_MARGIN 64  // minimum Timer 2 counts left before the next interval for idle mode to be worth entering (avoids sleeping through a tick about to fire)
+
+// hardware timer allocation
+//      Timer 0: the half-periods of the PS/2 clock pulses while a byte is sent or received, and delay_us(), only for blocking waits outside the scheduler (the BREAK
+//               between response bytes to host commands, and the basic assurance test)
+//      Timer 1: the UART's baud rate generator when telemetry or the UART transport is built in, otherwise free
+//      Timer 2: the 10ms tick (ELAPSED_TIME and TICK_COUNT) the scheduler's task periods are counted in, and read between ticks as the fine time base of every deadline
+//               (column settle, the gap between bytes) and time-stamp
+
+// press-to-host latency histogram, each key change being time-stamped as it is queued and measured again once the stop bit of its last byte has gone out
+//      latencies are kept in units of 16 Timer 2 counts (8us at 24 MHz, 16us at 12 MHz, 4us at 24 MHz in X2 mode), bucket 0 counting those under 1 << LATENCY_FLOOR_SHIFT units and each bucket after it
+//      spanning twice the latencies of the one before, the last also taking everything longer (at 24 MHz: under 1ms, 2ms, 4ms, 8ms, 16ms, then 16ms and over). No key
+//      change reaches the host in under a frame, 11 clock pulses taking 0.7ms at the fastest link speed, so bucket 0 starts at 1ms rather than spending RAM on empty buckets.
+//      NOTE: the 16-bit stamps wrap after about 0.5s at 24 MHz, so while the host inhibits, the stamps of the key changes waiting on it are held at no more than half a wrap
+//      old (see ageStamps()), and a change held up longer than that still lands in the last bucket rather than wrapping round to a short latency
+#define LATENCY_BUCKETS 6
+#define LATENCY_FLOOR_SHIFT 7
+
+// output transport of key events, TRANSPORT_PS2 for the PS/2 link, TRANSPORT_UART for set 2 scancode bytes straight out of the UART (no parity or framing beyond the
+//      UART's own, and no link gap or host inhibit to wait for), or both (each byte goes out of the UART as well once it has gone out whole over PS/2).
+//      Host commands and their responses always go over PS/2.
+#define TRANSPORT_PS2  0x01
+#define TRANSPORT_UART 0x02
+#define TRANSPORT TRANSPORT_PS2
+
+// UART telemetry, 0 to leave it out or 1 to stream timestamped trace records out of the UART for capture with a serial adapter and offline analysis
+//      (the UART carries either telemetry or key events, not both). Each record is 4 bytes, a TRACE_ type, a data byte and the latencyStamp() it was taken at (low byte first).
+//      The stamp wraps after about 0.5s at 24 MHz (0.26s in X2 mode), so a TRACE_TIME record goes out every TRACE_TIME_PERIOD 10ms intervals for the stamps to be unwrapped offline.
+#define TELEMETRY 0
+#define TRACE_TIME_PERIOD 16  // must keep below the wrap of latencyStamp() (26 intervals at 24 MHz in X2 mode)
+#define TRACE_KEY     0x01 // a key event queued (the key identifier, bit 7 set for a release)
+#define TRACE_BYTE    0x02 // a byte sent whole to the host
+#define TRACE_HOST    0x03 // a byte received from the host (a command or its argument)
+#define TRACE_INHIBIT 0x04 // the host started (1) or stopped (0) holding the clock low
+#define TRACE_TIME    0x05 // periodic time reference (0)
+#define TRACE_DROP    0x06 // records dropped for want of buffer room since the last one went in, the one it took the place of included (saturating at 255)
+#define TRACE_BOUNCE  0x07 // a bounce rejected by debounce (the key-matrix position)
+#if TELEMETRY
+#define TRACE(type, data) trace(type, data)
+#else
+#define TRACE(type, data)
+#endif
+
+// on-chip UART, used when telemetry or the UART transport is built in
+//      TXD is P3.1, shared with key-matrix column 9, so such a build expects that column rewired to the otherwise unused P3.6, leaving P3.1 high for the UART to drive.
+//      The UART runs in mode 1 (8 data bits, no parity, 1 stop bit) off Timer 1 in auto-reload mode with SMOD set, at UART_BAUD, Timer 1's reload being worked out from
+//      CLOCK and CLOCKS_PER_COUNT as Timer 2's is (0xff at 24 MHz, 0xfe at 24 MHz in X2 mode). The fastest rate is CLOCK / (16 * CLOCKS_PER_COUNT), 125000 baud at 24 MHz
+//      and 62500 baud at 12 MHz (twice these in X2 mode), and a UART_BAUD the timer cannot reach within 2% stops the build. Standard
+//      115200 baud is not reachable from a 24 MHz crystal (125000 is 8.5% off it), adapters that take arbitrary rates (FTDI, CP210x and the like) must be set to 125000.
+//      Bytes are sent from UART_BUFFER_SIZE bytes of buffer by the serial interrupt, which never runs while a byte is clocked to or from the host (interrupts are disabled
+//      then), so the PS/2 bit timing is left undisturbed.
+#define UART (TELEMETRY || (TRANSPORT & TRANSPORT_UART))
+#define UART_BAUD 125000UL
+#define UART_TOP_BAUD (CLOCK * 1000000UL / (16UL * CLOCKS_PER_COUNT)) // the baud rate of a Timer 1 overflow per bit with SMOD set
+#define UART_DIVISOR ((UART_TOP_BAUD + UART_BAUD / 2) / UART_BAUD)     // Timer 1 overflows per bit, rounded to the nearest
+#define UART_RELOAD (256 - UART_DIVISOR) // Timer 1 reload, the baud rate being UART_TOP_BAUD / (256 - UART_RELOAD)
+#if UART
+#if UART_DIVISOR < 1 || UART_DIVISOR > 256
+#error "UART_BAUD is out of reach of Timer 1 at this CLOCK"
+#elif (UART_TOP_BAUD / UART_DIVISOR) * 50 > UART_BAUD * 51 || (UART_TOP_BAUD / UART_DIVISOR) * 50 < UART_BAUD * 49
+#error "UART_BAUD is not reachable within 2% at this CLOCK"
+#endif
+#endif
+#define UART_BUFFER_SIZE 8 // must be a power of 2 (holding one byte less, so one whole trace record, see trace())
+#if TELEMETRY && UART_BUFFER_SIZE - 1 < 4
+#error "UART_BUFFER_SIZE must hold a whole 4-byte trace record"
+#endif
+#if TELEMETRY && (TRANSPORT & TRANSPORT_UART)
+#error "TELEMETRY and TRANSPORT_UART both need the UART"
+#endif
+
+// cooperative scheduler, main() runs the tasks of TASK_FUNCTIONS round after round in order of priority, a task with a non-zero TASK_PERIODS entry only once that many
+//      10ms intervals have passed since it last ran. No task blocks: each does one step of its work (a column read, a column debounced, a byte sent) and returns, waiting
+//      on a deadline by returning until it has passed, so a round takes at most about a millisecond (a byte sent) and a host request waits no longer than that.
+//      With TASK_PROFILE set to 1, the time spent in each task is added up in TASK_TIMES (in units of 16 Timer 2 counts) and appended to the vendor diagnostic dump.
+//      The times wrap at 65536 like the free-running counters (after 0.5s of a task's own time at 24 MHz), so a test rig reads them twice within that and takes the difference.
+#define TASK_PROFILE 0
+#define TASK_RX        0 // host RX, receiving and following host commands
+#define TASK_TX        1 // link TX, tracking host inhibits and sending the next queued byte once the gap since the last has passed
+#define TASK_SCAN      2 // matrix scan, driving a column and reading its rows once it has settled
+#define TASK_DEBOUNCE  3 // debounce, turning the column read into key events
+#define TASK_TYPEMATIC 4 // typematic, flagging repeats of the typematic key
+#define TASK_DUAL      5 // dual-role keys, deciding an undecided dual-role key is held once DUAL_HOLD_TIME has passed
+#define TASK_LED       6 // LED update, refreshing the lock LEDs from LED_STATE
+#if TELEMETRY
+#define TASK_TRACE     7 // telemetry time reference
+#define TASK_COUNT     8
+#else
+#define TASK_COUNT     7
+#endif
+#define TASK_PERIODIC  TASK_TYPEMATIC // the first task with a period, only the tasks from it on having one (and a time-stamp in TASK_STAMPS)
+
+// RAM budget, the AT89S52's 256 bytes of internal RAM holding register bank 0, the bit flags, the static variables, the locals SDCC gives a static home and the stack.
+//      Counted by hand, the statics (bank 0 and bit flags included) come to 193 bytes in the default profile, 209 in the gaming profile, 206 with telemetry, 204 with the
+//      UART transport and 207 with TASK_PROFILE. On top of them come the locals with a static home: 9 bytes of parameters (every one past the first), 3 bytes of locals
+//      whose address is taken (ticks in sendDump(), held in sendKeyStats()) and about 2 bytes of debounceTask()'s 10 bytes of locals not fitting in registers R0 - R7.
+//      The stack then takes 16 bytes of return addresses on the deepest call chain (main(), rxTask(), followCommand(), sendDump(), sendBlock(), transmit(), linkError()
+//      and elapsedSince(), or 18 with telemetry as trace(), latencyStamp() and readTimer2() follow transmit()) and up to 10 bytes pushed by an interrupt, leaving 23 bytes
+//      for the registers SDCC saves across calls in the default profile, 12 with the UART transport, 9 with TASK_PROFILE, 8 with telemetry and only 7 in the gaming profile.
+//      Hence UART_BUFFER_SIZE, LATENCY_BUCKETS, KEY_ATTRIBUTE_SLOTS and KEY_STAT_SLOTS being no larger than they are, and only one of these options built in at a time.
+//      NOTE: recount against the keyboard.mem SDCC writes after growing any variable (the stack starts after the last byte it lists and has no other limit than the top of RAM)
+#if GAMING + UART + TASK_PROFILE > 1
+#error "GAMING, the UART (TELEMETRY or TRANSPORT_UART) and TASK_PROFILE do not fit in RAM together, only one may be set"
+#endif
+
+// vendor diagnostic commands, taken from the unused command range below the standard PS/2 commands (0xE3 - 0xEC are left free for more, and answered with a resend like any unknown command)
+//      VENDOR_DUMP is acknowledged and followed by a burst of DUMP_LENGTH bytes (16-bit values low byte first, times in units of 16 Timer 2 counts as with the latency histogram):
+//          DUMP_LENGTH, LATENCY_HISTOGRAM[6], SCAN_TIME_MIN, SCAN_TIME_MAX, QUEUE_HIGH_WATER, QUEUE_OVERFLOWS, LINK_SPEED, LINK_BYTES, RESENDS, TX_ABORTS, HOST_INHIBITS,
+//          FLUSH_DELAY_MAX, SCAN_PASSES, TICK_COUNT, SLEEP_COUNTS (4 bytes), BAT_TIME, KEY_STATES[14] (the key-matrix, one byte per column with a bit per row)
+//      VENDOR_CLEAR is acknowledged and starts the histogram, counters and minimums/maximums over, the key statistics included (the link speed and key-matrix are left as they are)
+//      VENDOR_KEY_STATS is acknowledged and followed by a burst of KEY_STATS_LENGTH bytes (see KEY_STAT_SLOTS):
+//          KEY_STATS_LENGTH, KEY_PRESSES (4 bytes), KEY_BOUNCES, KEY_STAT_POSITIONS[2], KEY_STAT_BOUNCES[2], KEY_STAT_PRESSES[2] (2 bytes each), KEY_STAT_HOLDS[2]
+//          (2 bytes each), a byte with a bit per slot whose key is held right now (its hold so far counted in KEY_STAT_HOLDS), KEY_TEST_HELD[4]
+//      NOTE: while a set 3 command is naming keys (0xFB - 0xFD), these bytes are taken as key codes like any other byte below 0xED
+#define VENDOR_DUMP  0xe0
+#define VENDOR_CLEAR 0xe1
+#define VENDOR_KEY_STATS 0xe2
+#if TASK_PROFILE
+#define DUMP_LENGTH (54 + 2 * TASK_COUNT) // followed by TASK_TIMES[TASK_COUNT] (2 bytes each)
+#else
+#define DUMP_LENGTH 54
+#endif
+
+// per-key switch statistics, for spotting worn or chattering switches by their key-matrix position (column * 6 + row, the order of KEY_MAP)
+//      every press is counted in KEY_PRESSES, and every change debounce rejects as a bounce in KEY_BOUNCES (a reading that reverts before its second visit, or in the gaming
+//      profile a change while the key is locked out). The keys with the most bounces get a slot each, counting their own bounces and presses and their longest hold (in 10ms
+//      intervals, the hold under way included), all saturating rather than wrapping. A key bouncing with every slot taken replaces the one with the fewest bounces and carries on from that count
+//      plus one, so it can only ever displace the least-bouncing key: a chattering switch keeps its slot while one-off bounces take turns in the last one (a slot with no
+//      bounces is unused).
+//      NOTE: a slot's bounces are therefore an upper bound for its key, over-counting by at most the bounces it inherited; its presses and longest hold are its own
+//      A key stuck down from power-on is never pressed or released, and is kept out of the key events by the basic assurance test taking it as already held (see
+//      selfTest()), so the test lists the key-matrix positions of the keys it found held in KEY_TEST_HELD instead (0xff for none).
+//      NOTE: 256 bytes of RAM cannot hold counters for every one of the 84 keys, hence the slots for the few misbehaving ones
+//      NOTE: holds saturate at 0x8000 intervals (5.5 minutes), beyond which a key is stuck rather than held, and their time-stamps are held back from wrapping round by
+//      updateHolds() every scan pass
+#define KEY_STAT_SLOTS 2
+#define KEY_TEST_HELD_SLOTS 4 // more keys found held than this is a key-matrix fault rather than stuck switches, the first found being listed
+#define KEY_STATS_LENGTH (8 + 6 * KEY_STAT_SLOTS + KEY_TEST_HELD_SLOTS)
+
+// hardware watchdog of the AT89S52, started by the first feed in main() and fed once per scheduler round (and through the few waits on the host that outlast a round),
+//      resetting the MCU should the firmware hang for 16384 machine cycles (8.2ms at 24 MHz, 16.4ms at 12 MHz). A reset it causes is told apart from power-on by WARM_KEY
+//      still holding WARM_MAGIC in RAM, and takes a warm restart: the LED state is kept, the BAT_DELAY wait is skipped and 0xAA is sent right away, which the host takes
+//      as the keyboard being plugged in again and re-initializes it, so typing resumes within milliseconds of the hang.
+//      NOTE: the watchdog is held while the CPU idles (WDIDLE set in AUXR), as a 10ms interval asleep outlasts its timeout at 24 MHz. It is the AT89S52's own, parts
+//      with faster cores keep theirs elsewhere, so it is only built in for standard 12 clock cores.
+#define WATCHDOG (CLOCKS_PER_CYCLE == 12)
+#define WARM_MAGIC 0xa55a
+#if WATCHDOG
+__sfr __at (0xA6) WDTRST; // watchdog reset, fed with 0x1E then 0xE1
+__sfr __at (0x8E) AUXR;   // auxiliary register, bit 4 (WDIDLE) holding the watchdog in idle mode
+#define FEED_WATCHDOG() do{ WDTRST = 0x1e; WDTRST = 0xe1; }while(0)
+#else
+#define FEED_WATCHDOG()
+#endif
 
 // version stamp to be included in the binary, only for documentation purposes and fun :)
+// NOTE: code has to end below it, leaving 8127 bytes (0x1FBF) for the code and __code tables. The tables take about 1.3KB (KEY_SEQUENCES being kept as bare bytes for
+//      it), and the code takes roughly 6.5KB in the default profile and up to 7KB with telemetry, going by the v1.0 build's code size per statement. As that leaves
+//      little to spare in the default profile and may not fit at all with telemetry, build with sdcc --code-size 0x1fbf keyboard.c so the linker refuses code running into the version stamp, and check the size in keyboard.map
 __code __at (0x1FBF) char VERSION[64] = {"Huffman Computer Science. PS/2 Keyboard From Scratch. v_1.0"};
 
-// 2D array to house key scan codes of key matrix (as well as each code's parity and stop bit in the 2nd-byte)
-const uint32_t KEY_SCAN_CODES[14][6] = {
-    { 0x0314, 0x0312, 0x0258, 0x020d, 0x020e, 0x0276 },         // { L_CTRL, L_SHFT, CAPS, TAB, B_T, ESC },
-    { 0xe0021f, 0x021a, 0x021c, 0x0215, 0x0216, 0x00 },         // { WIN, Z, A, Q, R_1, 0 },
-    { 0x0311, 0x0322, 0x031b, 0x031d, 0x031e, 0x0305 },         // { L_ALT, X, S, W, R_2, F_1 },
-    { 0x00, 0x0321, 0x0223, 0x0324, 0x0226, 0x0306 },           // { 0, C, D, E, R_3, F_2 },
-    { 0x00, 0x022a, 0x032b, 0x032d, 0x0225, 0x0204 },           // { 0, V, F, R, R_4, F_3 },
-    { 0x00, 0x0232, 0x0234, 0x022c, 0x032e, 0x030c },           // { 0, BB, G, T, R_5, F_4 },
-    { 0x0229, 0x0231, 0x0333, 0x0335, 0x0336, 0x00 },           // { SPACE, N, H, Y, R_6, 0 },
-    { 0x00, 0x033a, 0x023b, 0x033c, 0x023d, 0x0303 },           // { 0, M, J, U, R_7, F_5 },
-    { 0x00, 0x0341, 0x0342, 0x0243, 0x023e, 0x020b },           // { 0, COMMA, K, I, R_8, F_6 },
-    { 0xe00311, 0x0249, 0x034b, 0x0344, 0x0246, 0x0283 },       // { R_ALT, PER, L, O, R_9, F_7 },
-    { 0xe00327, 0x024a, 0x024c, 0x034d, 0x0245, 0x030a },       // { WIFN, B_SLA, S_COL, PP, R_0, F_8 },
-    { 0xe0022f, 0x00, 0x0252, 0x0254, 0x034e, 0x0201 },         // { MENUS, 0,  F_T, L_BRAK, SUB, F_9 },
-    { 0x00, 0x00, 0x0378, 0x025b, 0x0355, 0x0309 },             // { 0, 0, F_11, R_BRAK, EQU, F_10 },
-    { 0xe00314, 0x0359, 0x035a, 0x025d, 0x0366, 0x0207 }        // { R_CTRL, R_SHFT, ENTER, F_SLA, BCKSP, F_12 }
+// key identifiers, each indexing its make and break byte sequences in KEY_SEQUENCES (kept below 0x80, as bit 7 of a queued key event flags a release)
+#define K_NONE    0x00 // no key (unused matrix position)
+#define K_L_CTRL  0x01 // left control
+#define K_L_SHFT  0x02 // left shift
+#define K_CAPS    0x03 // caps lock
+#define K_TAB     0x04 // tab
+#define K_B_T     0x05 // back tick
+#define K_ESC     0x06 // escape
+#define K_WIN     0x07 // left windows
+#define K_Z       0x08 // z
+#define K_A       0x09 // a
+#define K_Q       0x0a // q
+#define K_R_1     0x0b // 1
+#define K_L_ALT   0x0c // left alt
+#define K_X       0x0d // x
+#define K_S       0x0e // s
+#define K_W       0x0f // w
+#define K_R_2     0x10 // 2
+#define K_F_1     0x11 // F1
+#define K_C       0x12 // c
+#define K_D       0x13 // d
+#define K_E       0x14 // e
+#define K_R_3     0x15 // 3
+#define K_F_2     0x16 // F2
+#define K_V       0x17 // v
+#define K_F       0x18 // f
+#define K_R       0x19 // r
+#define K_R_4     0x1a // 4
+#define K_F_3     0x1b // F3
+#define K_BB      0x1c // b
+#define K_G       0x1d // g
+#define K_T       0x1e // t
+#define K_R_5     0x1f // 5
+#define K_F_4     0x20 // F4
+#define K_SPACE   0x21 // space
+#define K_N       0x22 // n
+#define K_H       0x23 // h
+#define K_Y       0x24 // y
+#define K_R_6     0x25 // 6
+#define K_M       0x26 // m
+#define K_J       0x27 // j
+#define K_U       0x28 // u
+#define K_R_7     0x29 // 7
+#define K_F_5     0x2a // F5
+#define K_COMMA   0x2b // comma
+#define K_K       0x2c // k
+#define K_I       0x2d // i
+#define K_R_8     0x2e // 8
+#define K_F_6     0x2f // F6
+#define K_R_ALT   0x30 // right alt
+#define K_PER     0x31 // period
+#define K_L       0x32 // l
+#define K_O       0x33 // o
+#define K_R_9     0x34 // 9
+#define K_F_7     0x35 // F7
+#define K_WIFN    0x36 // right windows
+#define K_B_SLA   0x37 // forward slash
+#define K_S_COL   0x38 // semicolon
+#define K_PP      0x39 // p
+#define K_R_0     0x3a // 0
+#define K_F_8     0x3b // F8
+#define K_MENUS   0x3c // menu
+#define K_F_T     0x3d // apostrophe
+#define K_L_BRAK  0x3e // left bracket
+#define K_SUB     0x3f // minus
+#define K_F_9     0x40 // F9
+#define K_F_11    0x41 // F11
+#define K_R_BRAK  0x42 // right bracket
+#define K_EQU     0x43 // equals
+#define K_F_10    0x44 // F10
+#define K_R_CTRL  0x45 // right control
+#define K_R_SHFT  0x46 // right shift
+#define K_ENTER   0x47 // enter
+#define K_F_SLA   0x48 // back slash
+#define K_BCKSP   0x49 // backspace
+#define K_F_12    0x4a // F12
+#define K_PRTSC   0x4b // print screen
+#define K_PAUSE   0x4c // pause/break (make only)
+#define K_SCRLK   0x4d // scroll lock
+#define K_INS     0x4e // insert
+#define K_DEL     0x4f // delete
+#define K_HOME    0x50 // home
+#define K_END     0x51 // end
+#define K_PGUP    0x52 // page up
+#define K_PGDN    0x53 // page down
+#define K_UP      0x54 // up arrow
+#define K_DOWN    0x55 // down arrow
+#define K_LEFT    0x56 // left arrow
+#define K_RIGHT   0x57 // right arrow
+#define K_MUTE    0x58 // mute
+#define K_VOL_D   0x59 // volume down
+#define K_VOL_U   0x5a // volume up
+#define K_PLAY    0x5b // play/pause
+#define K_STOP    0x5c // stop
+#define K_PREV    0x5d // previous track
+#define K_NEXT    0x5e // next track
+#define K_NUMLK   0x5f // number lock
+#define K_KP_SLA  0x60 // keypad slash
+#define K_KP_MUL  0x61 // keypad asterisk
+#define K_KP_SUB  0x62 // keypad minus
+#define K_KP_ADD  0x63 // keypad plus
+#define K_KP_ENT  0x64 // keypad enter
+#define K_KP_DOT  0x65 // keypad period
+#define K_KP_0    0x66 // keypad 0
+#define K_KP_1    0x67 // keypad 1
+#define K_KP_2    0x68 // keypad 2
+#define K_KP_3    0x69 // keypad 3
+#define K_KP_4    0x6a // keypad 4
+#define K_KP_5    0x6b // keypad 5
+#define K_KP_6    0x6c // keypad 6
+#define K_KP_7    0x6d // keypad 7
+#define K_KP_8    0x6e // keypad 8
+#define K_KP_9    0x6f // keypad 9
+#define K_FN      0x70 // Fn layer shift (sends nothing itself, selects layer 1 while held, see DUAL_ROLES)
+#define K_MACRO1  0x71 // macro typing the project name (make only)
+#define K_MACRO2  0x72 // macro pressing ctrl + shift + escape (make only)
+#define KEY_COUNT 0x73
+#define KEY_SET3_COUNT K_FN // the key identifiers below this, the only ones with a scan code set 3 code
+#define KEY_MODIFIER(key) ((key) == K_L_CTRL || (key) == K_L_SHFT || (key) == K_L_ALT || (key) == K_WIN || (key) == K_R_ALT || (key) == K_WIFN || (key) == K_R_CTRL || (key) == K_R_SHFT)
+
+// layered key map, one 2D array per layer mapping the key matrix to key identifiers (K_NONE where no switch sits at an intersection), stored back to back in code memory
+//      layer 0 is the base layout, layer 1 is selected while the Fn key (WIFN position) is held and adds media keys on the F-row, navigation and macros on the left hand, and a numpad on the right hand
+//      the Fn key and menu key are dual-role keys, each acting as one key when tapped and another when held (see DUAL_ROLES)
+//      keys without an Fn function repeat their base key in layer 1, so a lookup never has to fall through from one layer to another
+// NOTE: print screen and pause have no place on the 84-key base layout, they are also mapped to two otherwise unused intersections for boards with switches wired there
+#define LAYER_COUNT 2 // the layer each held key was pressed on is tracked with one bit per key, so at most 2 layers are supported
+__code unsigned char KEY_MAP[LAYER_COUNT][14][6] = {
+    {
+        { K_L_CTRL, K_L_SHFT, K_CAPS, K_TAB, K_B_T, K_ESC },
+        { K_WIN, K_Z, K_A, K_Q, K_R_1, K_PAUSE },
+        { K_L_ALT, K_X, K_S, K_W, K_R_2, K_F_1 },
+        { K_NONE, K_C, K_D, K_E, K_R_3, K_F_2 },
+        { K_NONE, K_V, K_F, K_R, K_R_4, K_F_3 },
+        { K_NONE, K_BB, K_G, K_T, K_R_5, K_F_4 },
+        { K_SPACE, K_N, K_H, K_Y, K_R_6, K_PRTSC },
+        { K_NONE, K_M, K_J, K_U, K_R_7, K_F_5 },
+        { K_NONE, K_COMMA, K_K, K_I, K_R_8, K_F_6 },
+        { K_R_ALT, K_PER, K_L, K_O, K_R_9, K_F_7 },
+        { K_FN, K_B_SLA, K_S_COL, K_PP, K_R_0, K_F_8 },
+        { K_MENUS, K_NONE, K_F_T, K_L_BRAK, K_SUB, K_F_9 },
+        { K_NONE, K_NONE, K_F_11, K_R_BRAK, K_EQU, K_F_10 },
+        { K_R_CTRL, K_R_SHFT, K_ENTER, K_F_SLA, K_BCKSP, K_F_12 }
+    },
+    {
+        { K_L_CTRL, K_L_SHFT, K_CAPS, K_TAB, K_B_T, K_ESC },
+        { K_WIN, K_Z, K_LEFT, K_HOME, K_MACRO1, K_PAUSE },      // A = left, Q = home, 1 = macro 1
+        { K_L_ALT, K_X, K_DOWN, K_UP, K_MACRO2, K_MUTE },       // S = down, W = up, 2 = macro 2, F1 = mute
+        { K_NONE, K_C, K_RIGHT, K_END, K_R_3, K_VOL_D },        // D = right, E = end, F2 = volume down
+        { K_NONE, K_V, K_PGDN, K_PGUP, K_R_4, K_VOL_U },        // F = page down, R = page up, F3 = volume up
+        { K_NONE, K_BB, K_G, K_T, K_R_5, K_PLAY },              // F4 = play/pause
+        { K_SPACE, K_N, K_H, K_Y, K_R_6, K_PRTSC },
+        { K_NONE, K_KP_0, K_KP_1, K_KP_4, K_KP_7, K_STOP },     // M/J/U/7 = keypad 0/1/4/7, F5 = stop
+        { K_NONE, K_COMMA, K_KP_2, K_KP_5, K_KP_8, K_PREV },    // K/I/8 = keypad 2/5/8, F6 = previous track
+        { K_R_ALT, K_KP_DOT, K_KP_3, K_KP_6, K_KP_9, K_NEXT },  // PER/L/O/9 = keypad ./3/6/9, F7 = next track
+        { K_FN, K_KP_SLA, K_KP_ADD, K_KP_SUB, K_KP_MUL, K_NUMLK }, // B_SLA/S_COL/PP/0 = keypad / + - *, F8 = number lock
+        { K_WIFN, K_NONE, K_F_T, K_L_BRAK, K_SUB, K_PRTSC },    // MENUS = right windows, F9 = print screen
+        { K_NONE, K_NONE, K_PAUSE, K_R_BRAK, K_EQU, K_SCRLK },  // F11 = pause, F10 = scroll lock
+        { K_R_CTRL, K_R_SHFT, K_KP_ENT, K_F_SLA, K_DEL, K_INS } // ENTER = keypad enter, BCKSP = delete, F12 = insert
+    }
+};
+
+// dual-role keys, the key identifiers of DUAL_KEYS acting as their DUAL_TAPS key when tapped and their DUAL_HOLDS key when held (K_FN being the layer shift)
+//      nothing is sent on the press of a dual-role key, its role is decided as held the moment another key is pressed (the other key then going out after the hold
+//      role, and under Fn being looked up on layer 1) or once DUAL_HOLD_TIME intervals pass, and as tapped if it is released before either (the tap role's press and
+//      release then going out together). Other keys are never held back, so only the dual-role keys themselves wait on the decision, at most DUAL_HOLD_TIME + 1
+//      intervals (200 - 210ms), and a key pressed meanwhile decides it at once.
+//      the WIFN position is the Fn layer shift when held and right windows when tapped, the menu key is right windows when held (the modifier the Fn key took the place
+//      of) and menu when tapped. In layer 1 the menu key position is a plain right windows key.
+#define DUAL_ROLES 2
+#define DUAL_NONE 0xff     // no dual-role key (an index into DUAL_KEYS otherwise)
+#define DUAL_HOLD_TIME 20  // 200ms for a dual-role key to be held before its hold role is taken (must stay below 128 as ELAPSED_TIME wraps at 128)
+__code unsigned char DUAL_KEYS[DUAL_ROLES] = { K_FN, K_MENUS };
+__code unsigned char DUAL_TAPS[DUAL_ROLES] = { K_WIFN, K_MENUS };
+__code unsigned char DUAL_HOLDS[DUAL_ROLES] = { K_FN, K_WIFN };
+
+// make and break byte sequences of every key, laid out back to back in key identifier order (kept as bare bytes, one byte of flash each, and given their parity and
+//      stop bit by frameByte() as they go out)
+__code unsigned char KEY_SEQUENCES[483] = {
+    0x14, 0xf0, 0x14,                                  // L_CTRL
+    0x12, 0xf0, 0x12,                                  // L_SHFT
+    0x58, 0xf0, 0x58,                                  // CAPS
+    0x0d, 0xf0, 0x0d,                                  // TAB
+    0x0e, 0xf0, 0x0e,                                  // B_T
+    0x76, 0xf0, 0x76,                                  // ESC
+    0xe0, 0x1f, 0xe0, 0xf0, 0x1f,                      // WIN
+    0x1a, 0xf0, 0x1a,                                  // Z
+    0x1c, 0xf0, 0x1c,                                  // A
+    0x15, 0xf0, 0x15,                                  // Q
+    0x16, 0xf0, 0x16,                                  // R_1
+    0x11, 0xf0, 0x11,                                  // L_ALT
+    0x22, 0xf0, 0x22,                                  // X
+    0x1b, 0xf0, 0x1b,                                  // S
+    0x1d, 0xf0, 0x1d,                                  // W
+    0x1e, 0xf0, 0x1e,                                  // R_2
+    0x05, 0xf0, 0x05,                                  // F_1
+    0x21, 0xf0, 0x21,                                  // C
+    0x23, 0xf0, 0x23,                                  // D
+    0x24, 0xf0, 0x24,                                  // E
+    0x26, 0xf0, 0x26,                                  // R_3
+    0x06, 0xf0, 0x06,                                  // F_2
+    0x2a, 0xf0, 0x2a,                                  // V
+    0x2b, 0xf0, 0x2b,                                  // F
+    0x2d, 0xf0, 0x2d,                                  // R
+    0x25, 0xf0, 0x25,                                  // R_4
+    0x04, 0xf0, 0x04,                                  // F_3
+    0x32, 0xf0, 0x32,                                  // BB
+    0x34, 0xf0, 0x34,                                  // G
+    0x2c, 0xf0, 0x2c,                                  // T
+    0x2e, 0xf0, 0x2e,                                  // R_5
+    0x0c, 0xf0, 0x0c,                                  // F_4
+    0x29, 0xf0, 0x29,                                  // SPACE
+    0x31, 0xf0, 0x31,                                  // N
+    0x33, 0xf0, 0x33,                                  // H
+    0x35, 0xf0, 0x35,                                  // Y
+    0x36, 0xf0, 0x36,                                  // R_6
+    0x3a, 0xf0, 0x3a,                                  // M
+    0x3b, 0xf0, 0x3b,                                  // J
+    0x3c, 0xf0, 0x3c,                                  // U
+    0x3d, 0xf0, 0x3d,                                  // R_7
+    0x03, 0xf0, 0x03,                                  // F_5
+    0x41, 0xf0, 0x41,                                  // COMMA
+    0x42, 0xf0, 0x42,                                  // K
+    0x43, 0xf0, 0x43,                                  // I
+    0x3e, 0xf0, 0x3e,                                  // R_8
+    0x0b, 0xf0, 0x0b,                                  // F_6
+    0xe0, 0x11, 0xe0, 0xf0, 0x11,                      // R_ALT
+    0x49, 0xf0, 0x49,                                  // PER
+    0x4b, 0xf0, 0x4b,                                  // L
+    0x44, 0xf0, 0x44,                                  // O
+    0x46, 0xf0, 0x46,                                  // R_9
+    0x83, 0xf0, 0x83,                                  // F_7
+    0xe0, 0x27, 0xe0, 0xf0, 0x27,                      // WIFN
+    0x4a, 0xf0, 0x4a,                                  // B_SLA
+    0x4c, 0xf0, 0x4c,                                  // S_COL
+    0x4d, 0xf0, 0x4d,                                  // PP
+    0x45, 0xf0, 0x45,                                  // R_0
+    0x0a, 0xf0, 0x0a,                                  // F_8
+    0xe0, 0x2f, 0xe0, 0xf0, 0x2f,                      // MENUS
+    0x52, 0xf0, 0x52,                                  // F_T
+    0x54, 0xf0, 0x54,                                  // L_BRAK
+    0x4e, 0xf0, 0x4e,                                  // SUB
+    0x01, 0xf0, 0x01,                                  // F_9
+    0x78, 0xf0, 0x78,                                  // F_11
+    0x5b, 0xf0, 0x5b,                                  // R_BRAK
+    0x55, 0xf0, 0x55,                                  // EQU
+    0x09, 0xf0, 0x09,                                  // F_10
+    0xe0, 0x14, 0xe0, 0xf0, 0x14,                      // R_CTRL
+    0x59, 0xf0, 0x59,                                  // R_SHFT
+    0x5a, 0xf0, 0x5a,                                  // ENTER
+    0x5d, 0xf0, 0x5d,                                  // F_SLA
+    0x66, 0xf0, 0x66,                                  // BCKSP
+    0x07, 0xf0, 0x07,                                  // F_12
+    0xe0, 0x12, 0xe0, 0x7c, 0xe0, 0xf0, 0x7c, 0xe0, 0xf0, 0x12, // PRTSC
+    0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77,    // PAUSE
+    0x7e, 0xf0, 0x7e,                                  // SCRLK
+    0xe0, 0x70, 0xe0, 0xf0, 0x70,                      // INS
+    0xe0, 0x71, 0xe0, 0xf0, 0x71,                      // DEL
+    0xe0, 0x6c, 0xe0, 0xf0, 0x6c,                      // HOME
+    0xe0, 0x69, 0xe0, 0xf0, 0x69,                      // END
+    0xe0, 0x7d, 0xe0, 0xf0, 0x7d,                      // PGUP
+    0xe0, 0x7a, 0xe0, 0xf0, 0x7a,                      // PGDN
+    0xe0, 0x75, 0xe0, 0xf0, 0x75,                      // UP
+    0xe0, 0x72, 0xe0, 0xf0, 0x72,                      // DOWN
+    0xe0, 0x6b, 0xe0, 0xf0, 0x6b,                      // LEFT
+    0xe0, 0x74, 0xe0, 0xf0, 0x74,                      // RIGHT
+    0xe0, 0x23, 0xe0, 0xf0, 0x23,                      // MUTE
+    0xe0, 0x21, 0xe0, 0xf0, 0x21,                      // VOL_D
+    0xe0, 0x32, 0xe0, 0xf0, 0x32,                      // VOL_U
+    0xe0, 0x34, 0xe0, 0xf0, 0x34,                      // PLAY
+    0xe0, 0x3b, 0xe0, 0xf0, 0x3b,                      // STOP
+    0xe0, 0x15, 0xe0, 0xf0, 0x15,                      // PREV
+    0xe0, 0x4d, 0xe0, 0xf0, 0x4d,                      // NEXT
+    0x77, 0xf0, 0x77,                                  // NUMLK
+    0xe0, 0x4a, 0xe0, 0xf0, 0x4a,                      // KP_SLA
+    0x7c, 0xf0, 0x7c,                                  // KP_MUL
+    0x7b, 0xf0, 0x7b,                                  // KP_SUB
+    0x79, 0xf0, 0x79,                                  // KP_ADD
+    0xe0, 0x5a, 0xe0, 0xf0, 0x5a,                      // KP_ENT
+    0x71, 0xf0, 0x71,                                  // KP_DOT
+    0x70, 0xf0, 0x70,                                  // KP_0
+    0x69, 0xf0, 0x69,                                  // KP_1
+    0x72, 0xf0, 0x72,                                  // KP_2
+    0x7a, 0xf0, 0x7a,                                  // KP_3
+    0x6b, 0xf0, 0x6b,                                  // KP_4
+    0x73, 0xf0, 0x73,                                  // KP_5
+    0x74, 0xf0, 0x74,                                  // KP_6
+    0x6c, 0xf0, 0x6c,                                  // KP_7
+    0x75, 0xf0, 0x75,                                  // KP_8
+    0x7d, 0xf0, 0x7d,                                  // KP_9
+    0x12, 0x33, 0xf0, 0x33, 0xf0, 0x12, 0x3c, 0xf0, 0x3c, 0x2b, 0xf0, 0x2b, // MACRO1
+    0x2b, 0xf0, 0x2b, 0x3a, 0xf0, 0x3a, 0x1c, 0xf0, 0x1c, 0x31, 0xf0, 0x31,
+    0x29, 0xf0, 0x29, 0x12, 0x21, 0xf0, 0x21, 0xf0, 0x12, 0x44, 0xf0, 0x44,
+    0x3a, 0xf0, 0x3a, 0x4d, 0xf0, 0x4d, 0x3c, 0xf0, 0x3c, 0x2c, 0xf0, 0x2c,
+    0x24, 0xf0, 0x24, 0x2d, 0xf0, 0x2d, 0x29, 0xf0, 0x29, 0x12, 0x1b, 0xf0,
+    0x1b, 0xf0, 0x12, 0x21, 0xf0, 0x21, 0x43, 0xf0, 0x43, 0x24, 0xf0, 0x24,
+    0x31, 0xf0, 0x31, 0x21, 0xf0, 0x21, 0x24, 0xf0, 0x24,
+    0x14, 0x12, 0x76, 0xf0, 0x76, 0xf0, 0x12, 0xf0, 0x14, // MACRO2
+};
+
+// start of each key's make sequence (at 2 * key) and break sequence (at 2 * key + 1) within KEY_SEQUENCES, a sequence ending where the next one starts
+__code unsigned int KEY_SEQUENCE_INDEX[KEY_COUNT * 2 + 1] = {
+    0, 0,                                // NONE
+    0, 1,                                // L_CTRL
+    3, 4,                                // L_SHFT
+    6, 7,                                // CAPS
+    9, 10,                               // TAB
+    12, 13,                              // B_T
+    15, 16,                              // ESC
+    18, 20,                              // WIN
+    23, 24,                              // Z
+    26, 27,                              // A
+    29, 30,                              // Q
+    32, 33,                              // R_1
+    35, 36,                              // L_ALT
+    38, 39,                              // X
+    41, 42,                              // S
+    44, 45,                              // W
+    47, 48,                              // R_2
+    50, 51,                              // F_1
+    53, 54,                              // C
+    56, 57,                              // D
+    59, 60,                              // E
+    62, 63,                              // R_3
+    65, 66,                              // F_2
+    68, 69,                              // V
+    71, 72,                              // F
+    74, 75,                              // R
+    77, 78,                              // R_4
+    80, 81,                              // F_3
+    83, 84,                              // BB
+    86, 87,                              // G
+    89, 90,                              // T
+    92, 93,                              // R_5
+    95, 96,                              // F_4
+    98, 99,                              // SPACE
+    101, 102,                            // N
+    104, 105,                            // H
+    107, 108,                            // Y
+    110, 111,                            // R_6
+    113, 114,                            // M
+    116, 117,                            // J
+    119, 120,                            // U
+    122, 123,                            // R_7
+    125, 126,                            // F_5
+    128, 129,                            // COMMA
+    131, 132,                            // K
+    134, 135,                            // I
+    137, 138,                            // R_8
+    140, 141,                            // F_6
+    143, 145,                            // R_ALT
+    148, 149,                            // PER
+    151, 152,                            // L
+    154, 155,                            // O
+    157, 158,                            // R_9
+    160, 161,                            // F_7
+    163, 165,                            // WIFN
+    168, 169,                            // B_SLA
+    171, 172,                            // S_COL
+    174, 175,                            // PP
+    177, 178,                            // R_0
+    180, 181,                            // F_8
+    183, 185,                            // MENUS
+    188, 189,                            // F_T
+    191, 192,                            // L_BRAK
+    194, 195,                            // SUB
+    197, 198,                            // F_9
+    200, 201,                            // F_11
+    203, 204,                            // R_BRAK
+    206, 207,                            // EQU
+    209, 210,                            // F_10
+    212, 214,                            // R_CTRL
+    217, 218,                            // R_SHFT
+    220, 221,                            // ENTER
+    223, 224,                            // F_SLA
+    226, 227,                            // BCKSP
+    229, 230,                            // F_12
+    232, 236,                            // PRTSC
+    242, 250,                            // PAUSE
+    250, 251,                            // SCRLK
+    253, 255,                            // INS
+    258, 260,                            // DEL
+    263, 265,                            // HOME
+    268, 270,                            // END
+    273, 275,                            // PGUP
+    278, 280,                            // PGDN
+    283, 285,                            // UP
+    288, 290,                            // DOWN
+    293, 295,                            // LEFT
+    298, 300,                            // RIGHT
+    303, 305,                            // MUTE
+    308, 310,                            // VOL_D
+    313, 315,                            // VOL_U
+    318, 320,                            // PLAY
+    323, 325,                            // STOP
+    328, 330,                            // PREV
+    333, 335,                            // NEXT
+    338, 339,                            // NUMLK
+    341, 343,                            // KP_SLA
+    346, 347,                            // KP_MUL
+    349, 350,                            // KP_SUB
+    352, 353,                            // KP_ADD
+    355, 357,                            // KP_ENT
+    360, 361,                            // KP_DOT
+    363, 364,                            // KP_0
+    366, 367,                            // KP_1
+    369, 370,                            // KP_2
+    372, 373,                            // KP_3
+    375, 376,                            // KP_4
+    378, 379,                            // KP_5
+    381, 382,                            // KP_6
+    384, 385,                            // KP_7
+    387, 388,                            // KP_8
+    390, 391,                            // KP_9
+    393, 393,                            // FN
+    393, 474,                            // MACRO1
+    474, 483,                            // MACRO2
+    483
+};
+
+// scan code set 3 code of each key in key identifier order (0x00 for keys without one), for looking up the keys named by the host in set 3 commands
+__code unsigned char KEY_SET3_CODES[KEY_COUNT] = {
+    0x00, 0x11, 0x12, 0x14, 0x0d, 0x0e, 0x08, 0x8b,          // NONE - WIN
+    0x1a, 0x1c, 0x15, 0x16, 0x19, 0x22, 0x1b, 0x1d,          // Z - W
+    0x1e, 0x07, 0x21, 0x23, 0x24, 0x26, 0x0f, 0x2a,          // R_2 - V
+    0x2b, 0x2d, 0x25, 0x17, 0x32, 0x34, 0x2c, 0x2e,          // F - R_5
+    0x1f, 0x29, 0x31, 0x33, 0x35, 0x36, 0x3a, 0x3b,          // F_4 - J
+    0x3c, 0x3d, 0x27, 0x41, 0x42, 0x43, 0x3e, 0x2f,          // U - F_6
+    0x39, 0x49, 0x4b, 0x44, 0x46, 0x37, 0x8c, 0x4a,          // R_ALT - B_SLA
+    0x4c, 0x4d, 0x45, 0x3f, 0x8d, 0x52, 0x54, 0x4e,          // S_COL - SUB
+    0x47, 0x56, 0x5b, 0x55, 0x4f, 0x58, 0x59, 0x5a,          // F_9 - ENTER
+    0x5c, 0x66, 0x5e, 0x57, 0x62, 0x5f, 0x67, 0x64,          // F_SLA - DEL
+    0x6e, 0x65, 0x6f, 0x6d, 0x63, 0x60, 0x61, 0x6a,          // HOME - RIGHT
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x76,          // MUTE - NUMLK
+    0x77, 0x7e, 0x84, 0x7c, 0x79, 0x71, 0x70, 0x69,          // KP_SLA - KP_1
+    0x72, 0x7a, 0x6b, 0x73, 0x74, 0x6c, 0x75, 0x7d,          // KP_2 - KP_9
+    0x00, 0x00, 0x00,                                        // FN - MACRO2
 };
-static unsigned int  LAST_BYTE = 0x00;   // for keeping track of last byte sent to host (for retransmission request)
-static unsigned char ENABLE = 1;         // for enabling/disabling keyscanning
-static unsigned char REPEAT_RATE = 50;   // for the rate at which a keycode is repeated (1000 / REPEAT_RATE * 10 hertz or cps)
-static unsigned char REPEAT_DELAY = 100; // for delay before a pressed key starts repeating (REPEAT_DELAY * 10 milliseconds)
+static unsigned char LAST_BYTE = 0x00;   // for keeping track of last byte sent to host (its data bits, framed again for a retransmission request)
+static __bit         ENABLE = 1;         // for enabling/disabling keyscanning
+static unsigned char LINK_SPEED = 0;     // for the index of the link speed in use (0 being fastest), kept across reset commands so a host that had trouble stays on the slower speed
+static unsigned char LINK_HALF = 0;      // for the Timer 0 reload timing each half of a clock pulse at the current link speed (copied from LINK_HALF_TIMES[LINK_SPEED])
+static unsigned char LINK_ERRORS = 0;    // for counting resend requests and inhibited transmissions within the current window
+static unsigned char LINK_WINDOW_STAMP = 0; // for time-stamping the start of the current window
+static unsigned char REPEAT_RATE = DEFAULT_REPEAT_RATE;   // for the rate at which a keycode is repeated (1000 / REPEAT_RATE * 10 hertz or cps)
+static unsigned char REPEAT_DELAY = DEFAULT_REPEAT_DELAY; // for delay before a pressed key starts repeating (REPEAT_DELAY * 10 milliseconds)
+static unsigned int  BAT_TIME = 0;       // for recording TICK_COUNT when BAT was reported at power-on, the boot-to-typing time in 10ms intervals
+static __idata unsigned char KEY_STATES[14]; // for keeping track of key-presses (one byte per column, one bit per row)
+static unsigned char KEY_ATTRIBUTES_ALL = 0; // for the attributes of every key without a slot of its own (KEY_NO_BREAK and KEY_NO_REPEAT)
+static __idata unsigned char KEY_ATTRIBUTE_KEYS[KEY_ATTRIBUTE_SLOTS]; // for the key identifier each slot of key attributes holds the attributes of (K_NONE if unused)
+static unsigned char KEY_SLOT_NO_BREAK = 0;  // for flagging the slots whose key sends no break codes (one bit per slot)
+static unsigned char KEY_SLOT_NO_REPEAT = 0; // for flagging the slots whose key never repeats (one bit per slot)
+static unsigned char KEY_ATTRIBUTE_COMMAND = 0; // for the set 3 command (0xFB - 0xFD) whose list of keys the host is sending, 0 if none
+#if GAMING
+static __idata unsigned char KEY_LOCKED[2][14]; // for ignoring keys that just changed while their contacts settle, in two generations cleared on alternate 10ms intervals (a lockout of 10 - 20ms)
+static unsigned char KEY_LOCKED_ANY = 0; // for flagging a generation has any key locked in it (bit 0 for generation 0, bit 1 for generation 1), so an empty generation costs nothing to expire
+static unsigned char EVENT_PRESSES = 0;  // for counting the events at the front of the event queue a press may not overtake (the presses queued ahead of releases, and all up to the last modifier release)
+#else
+static __idata unsigned char KEY_PENDING[14]; // for flagging keys whose reading differed from their state on the last visit (same bit layout as KEY_STATES)
+#endif
+static __idata unsigned char KEY_LAYERS[14]; // for tracking the layer each held key was pressed on (same bit layout as KEY_STATES), so it is released on that same layer
 static unsigned char ELAPSED_TIME = 0;   // for counting intervals of 10ms created by Timer 2 to keep track of when to repeat keycodes
+static __code unsigned char (*KEY_LAYER)[6] = KEY_MAP[0]; // for pointing at the active layer of KEY_MAP, so a lookup costs the same as indexing a single flat key map
+static unsigned char LAYER = 0;          // for the number of the active layer (the layer KEY_LAYER points at)
+static unsigned char DUAL_PENDING = DUAL_NONE; // for the dual-role key pressed whose role is still undecided (its index in DUAL_KEYS, DUAL_NONE if none)
+static unsigned char DUAL_STAMP = 0;     // for time-stamping that key's press
+static unsigned char DUAL_HOLDING = 0;   // for flagging the dual-role keys held in their hold role (one bit per index in DUAL_KEYS)
+static unsigned char TYPEMATIC_KEY = K_NONE;   // for the typematic key, the most recently pressed key and the only one that repeats (K_NONE if none)
+static unsigned char TYPEMATIC_STAMP = 0;       // for time-stamping the typematic key's press or last repeat
+static __bit         TYPEMATIC_REPEATING = 0;   // for flagging that REPEAT_DELAY was met and the typematic key is repeating at REPEAT_RATE
+static __bit         REPEAT_PENDING = 0;        // for flagging a typematic repeat is due (sent only once no key events are queued, dropped if it goes stale)
+static unsigned int  TX_INDEX = 0;       // for indexing the next byte in KEY_SEQUENCES of the event being sent (the event is complete when TX_INDEX == TX_END)
+static unsigned int  TX_END = 0;         // for indexing where the sequence of the event being sent ends
+static unsigned char TX_TICK = 0;        // for time-stamping (with the low byte of TICK_COUNT and Timer 2) when the last byte's stop bit was sent, to time the BREAK period from it
+static unsigned int  TX_COUNT = 0;
+static unsigned int  TX_GAP = BREAK_COUNTS; // for the Timer 2 counts to wait from that time-stamp before the next byte (BREAK after a byte, the shorter INHIBIT_GAP_COUNTS after an inhibit)
+static __bit         INHIBITED = 0;      // for flagging the host is holding the clock low (key changes are still scanned and queued meanwhile)
+static __bit         FLUSH_PENDING = 0;  // for flagging an inhibit ended with output queued, which is being flushed
+static unsigned char FLUSH_STAMP = 0;    // for time-stamping when that inhibit ended
+static unsigned char FLUSH_DELAY_MAX = 0; // for the longest time (in 10ms intervals) the host has waited after an inhibit for the output queued during it
+static __idata unsigned char EVENT_QUEUE[EVENT_QUEUE_SIZE]; // for queueing key press/release events in the order they were detected until the link is free
+static unsigned char EVENT_HEAD = 0;    // for indexing where the next event is queued
+static unsigned char EVENT_TAIL = 0;    // for indexing the oldest queued event (the queue is empty when EVENT_HEAD == EVENT_TAIL)
+static unsigned char SCAN_COLUMN = 14;   // for the column being driven and left to settle (14 while no pass is under way)
+static unsigned char SETTLE_TICK = 0;    // for time-stamping (with the low byte of TICK_COUNT and Timer 2) when that column was driven, to time the settle from
+static unsigned int  SETTLE_COUNT = 0;
+static unsigned char READ_COLUMN = 0xff; // for the column whose rows were read into READING, waiting to be debounced (0xff if none)
+static unsigned char READING = 0;        // for the rows read (one bit per row, as in KEY_STATES)
+static __bit         PASS_ACTIVE = 0;    // for flagging the scan pass under way found a key held or changed
+static unsigned char LED_STATE = 0;      // for the lock LEDs last set by the host (the argument of command 0xED), kept through a watchdog reset
+#if WATCHDOG
+static unsigned int  WARM_KEY = 0;       // for recognizing a watchdog reset, set to WARM_MAGIC once running (RAM keeps its contents through a reset, but not through power-off)
+#endif
+static unsigned char TASK_STAMPS[TASK_COUNT - TASK_PERIODIC]; // for time-stamping when each periodic task last ran (indexed from TASK_PERIODIC)
+#if TASK_PROFILE
+static __idata unsigned int TASK_TIMES[TASK_COUNT]; // for adding up the time spent in each task (in units of 16 Timer 2 counts, wrapping at 65536)
+#endif
+static unsigned char LAST_ACTIVITY = 0;  // for time-stamping the last scan pass that found a key held or changed (used to detect idleness)
+static unsigned char LAST_SCAN = 0;      // for time-stamping the start of the last scan pass (used to pace scanning while idle)
+static __bit         IDLE = 0;           // for flagging that IDLE_TIMEOUT has passed without activity (kept as a flag since ELAPSED_TIME wraps)
+static unsigned int  TICK_COUNT = 0;     // for counting every 10ms interval since power-on (wraps after ~11 minutes), the awake + asleep total in units of TICK_COUNTS
+static unsigned long SLEEP_COUNTS = 0;   // for accumulating Timer 2 counts spent in idle mode, so SLEEP_COUNTS / (TICK_COUNT * TICK_COUNTS) is the fraction of time asleep
+static __idata unsigned int EVENT_STAMPS[EVENT_QUEUE_SIZE]; // for time-stamping (with latencyStamp()) when each queued event was detected, alongside EVENT_QUEUE
+static __bit         LATENCY_PENDING = 0; // for flagging the event being sent is a key change whose latency is measured once its last byte is out (repeats are not measured)
+static unsigned int  LATENCY_STAMP = 0;  // for the time-stamp of when that key change was detected
+static __idata unsigned int LATENCY_HISTOGRAM[LATENCY_BUCKETS]; // for counting key changes by their press-to-host latency (see LATENCY_BUCKETS)
+// free-running counters (each wrapping at 65536, so a test rig reads them twice and takes the difference), kept across reset commands
+static __idata unsigned int SCAN_PASSES;     // for counting completed scan passes of the key-matrix
+static __idata unsigned int LINK_BYTES;      // for counting bytes sent whole to the host (responses included)
+static __idata unsigned int HOST_INHIBITS;   // for counting the times the host has started holding the clock low
+static __idata unsigned int RESENDS;         // for counting resend commands (0xFE) from the host
+static __idata unsigned int QUEUE_OVERFLOWS; // for counting key changes turned away by a full event queue (a change retried on every pass counts each time)
+static __idata unsigned int TX_ABORTS;       // for counting transmissions the host inhibited part way through
+static unsigned char QUEUE_HIGH_WATER = 0;   // for the most events the queue has held at once
+static unsigned int  SCAN_STAMP = 0;         // for time-stamping (with latencyStamp()) the start of the current scan pass
+static unsigned int  SCAN_TIME_MIN = 0xffff; // for the shortest and longest scan pass (in units of 16 Timer 2 counts, including any bytes sent and commands followed part way)
+static unsigned int  SCAN_TIME_MAX = 0;
+static unsigned long KEY_PRESSES = 0;    // for counting key presses of every key
+static unsigned int  KEY_BOUNCES = 0;    // for counting bounces rejected by debounce on every key (saturating at 0xffff)
+static __idata unsigned char KEY_STAT_POSITIONS[KEY_STAT_SLOTS]; // for the key-matrix position each slot of key statistics is counting for
+static __idata unsigned char KEY_STAT_BOUNCES[KEY_STAT_SLOTS];   // for that key's bounces rejected (saturating at 255, 0 if the slot is unused)
+static __idata unsigned int  KEY_STAT_PRESSES[KEY_STAT_SLOTS];   // for that key's presses (saturating at 0xffff)
+static __idata unsigned int  KEY_STAT_HOLDS[KEY_STAT_SLOTS];     // for that key's longest hold in 10ms intervals (saturating at 0x8000)
+static __idata unsigned int  KEY_STAT_STAMPS[KEY_STAT_SLOTS];    // for time-stamping (with TICK_COUNT) that key's last press
+static __idata unsigned char KEY_TEST_HELD[KEY_TEST_HELD_SLOTS]; // for the key-matrix positions of the keys the last basic assurance test found held (0xff for none)
+#if UART
+static __idata unsigned char UART_BUFFER[UART_BUFFER_SIZE]; // for buffering bytes until the UART has sent them
+static unsigned char UART_HEAD = 0;      // for indexing where the next byte is buffered
+static unsigned char UART_TAIL = 0;      // for indexing the next byte to send (the buffer is empty when UART_HEAD == UART_TAIL)
+static __bit         UART_BUSY = 0;      // for flagging the UART is sending, so the serial interrupt will pick up the next byte buffered
+#endif
+#if TELEMETRY
+static unsigned char TRACE_DROPS = 0;    // for counting records dropped since the last one buffered
+#endif
 
 // function for handling timer 2 interrupt service routine
 void timer2Int(void) __interrupt 5{
     ELAPSED_TIME++; // increment the counter for 10ms intervals for timing keycode repetition
+    TICK_COUNT++;   // increment the free-running counter used for awake/asleep accounting
+#if GAMING
+    // clear the older generation of debounce lockouts (if it has any), which becomes the generation keys are locked in for this interval
+    // NOTE: the two generations make a two-slot timer wheel on the 10ms tick, a lockout expiring when its slot comes round again, so only keys locked cost anything
+    unsigned char column;
+    if( KEY_LOCKED_ANY & (0x01 << (ELAPSED_TIME & 0x01)) ){
+        KEY_LOCKED_ANY &= ~(0x01 << (ELAPSED_TIME & 0x01));
+        for(column = 0; column < 14; column++)
+            KEY_LOCKED[ELAPSED_TIME & 0x01][column] = 0;
+    }
+#endif
     if( ELAPSED_TIME > 127 ) // prevent ELAPSED_TIME from exceeding 128 to save high bit
         ELAPSED_TIME = 0;
     TF2 = 0;        // clear Timer 2 overflow flag
 }//end_timer2Int__interrupt_5
 
+#if UART
+// function for handling the serial interrupt service routine, sending the next buffered byte once the UART has sent the last one
+void uartInt(void) __interrupt 4{
+    if( TI ){
+        TI = 0;
+        if( UART_TAIL != UART_HEAD ){
+            SBUF = UART_BUFFER[UART_TAIL];
+            UART_TAIL = (UART_TAIL + 1) & (UART_BUFFER_SIZE - 1);
+        }else{
+            UART_BUSY = 0;
+        }
+    }
+}//end_uartInt__interrupt_4
+#endif
+
+// function to determine how many 10ms intervals have passed since a time-stamp taken from ELAPSED_TIME (accounts for ELAPSED_TIME wrapping at 128)
+unsigned char elapsedSince(unsigned char stamp){
+    return (ELAPSED_TIME - stamp) & 0x7f;
+}//end_elapsedSince
+
+// function to read Timer 2 consistently (re-reading if the low byte overflowed into the high byte between reads), giving the machine cycles into the current 10ms interval offset by the reload value
+unsigned int readTimer2(void){
+    unsigned char high, low;
+    do{
+        high = TH2;
+        low = TL2;
+    }while( high != TH2 );
+    return (high << 8) | low;
+}//end_readTimer2
+
+// function to determine how many Timer 2 counts (machine cycles) have passed since a time-stamp taken from the low byte of TICK_COUNT and Timer 2, saturating at 0xffff
+// NOTE: this spans at most three 10ms intervals (about 32ms at 24 MHz, 16ms in X2 mode) before saturating, plenty for timing the gaps between bytes
+unsigned int countsSince(unsigned char tick, unsigned int count){
+    unsigned char nowTick;
+    unsigned int now;
+    // re-read if Timer 2 overflowed between reading the tick and the count
+    do{
+        nowTick = TICK_COUNT;
+        now = readTimer2();
+    }while( nowTick != (unsigned char)TICK_COUNT );
+    nowTick -= tick;
+    // within the same interval (the usual case for short deadlines) the difference of the counts is all there is to it
+    if( !nowTick )
+        return now - count;
+    if( nowTick > 3 )
+        return 0xffff;
+    unsigned long elapsed = (unsigned long)nowTick * TICK_COUNTS + now - count;
+    return elapsed > 0xffff ? 0xffff : elapsed;
+}//end_countsSince
+
+// function to take a time-stamp for measuring latencies, in units of 16 Timer 2 counts since power-on (wrapping after about 0.5s at 24 MHz, so two stamps must be taken within that)
+// NOTE: the whole of TICK_COUNT is used, as 65536 intervals of TICK_COUNTS / 16 units wrap exactly where the 16-bit stamp does
+unsigned int latencyStamp(void){
+    unsigned int tick, count;
+    // re-read if Timer 2 overflowed between reading the tick and the count
+    do{
+        tick = TICK_COUNT;
+        count = readTimer2();
+    }while( tick != TICK_COUNT );
+    // with interrupts disabled, an overflow since the last interrupt has reloaded Timer 2 without counting its tick yet
+    if( TF2 && (unsigned int)(count + TICK_COUNTS) < TICK_COUNTS / 2 )
+        tick++;
+    // Timer 2 counts up from its reload value of 0x10000 - TICK_COUNTS, so adding TICK_COUNTS gives the counts into the current interval
+    return tick * (unsigned int)(TICK_COUNTS / 16) + ((unsigned int)(count + TICK_COUNTS) >> 4);
+}//end_latencyStamp
+
+#if UART
+// function to determine how many more bytes UART_BUFFER has room for
+unsigned char uartRoom(void){
+    return (UART_TAIL - UART_HEAD - 1) & (UART_BUFFER_SIZE - 1);
+}//end_uartRoom
+
+// function to buffer a byte for the UART (the caller having checked uartRoom()), sent once uartStart() is called
+void uartPut(unsigned char data){
+    UART_BUFFER[UART_HEAD] = data;
+    UART_HEAD = (UART_HEAD + 1) & (UART_BUFFER_SIZE - 1);
+}//end_uartPut
+
+// function to start the UART on the bytes buffered if it is idle, the serial interrupt taking it from there
+void uartStart(void){
+    ES = 0;
+    if( !UART_BUSY && UART_TAIL != UART_HEAD ){
+        UART_BUSY = 1;
+        SBUF = UART_BUFFER[UART_TAIL];
+        UART_TAIL = (UART_TAIL + 1) & (UART_BUFFER_SIZE - 1);
+    }
+    ES = 1;
+}//end_uartStart
+#endif
+
+#if TELEMETRY
+// function to buffer a telemetry record for the UART, or count it as dropped if the buffer lacks room
+void trace(unsigned char type, unsigned char data){
+    unsigned int stamp = latencyStamp();
+    // a record is only buffered whole, along with a TRACE_DROP record ahead of it if any were dropped since the last
+    if( uartRoom() < 4 ){
+        if( TRACE_DROPS != 0xff )
+            TRACE_DROPS++;
+        return;
+    }
+    if( TRACE_DROPS ){
+        // with room for only one record, the TRACE_DROP record goes in its place and counts it as dropped too, so a buffer that never has room for two still recovers
+        if( uartRoom() < 8 ){
+            if( TRACE_DROPS != 0xff )
+                TRACE_DROPS++;
+            type = TRACE_DROP;
+            data = TRACE_DROPS;
+        }else{
+            uartPut(TRACE_DROP);
+            uartPut(TRACE_DROPS);
+            uartPut(stamp);
+            uartPut(stamp >> 8);
+        }
+        TRACE_DROPS = 0;
+    }
+    uartPut(type);
+    uartPut(data);
+    uartPut(stamp);
+    uartPut(stamp >> 8);
+    uartStart();
+}//end_trace
+#endif
+
+// function to put the CPU into idle mode until the next Timer 2 interrupt, accounting for the time spent asleep in SLEEP_COUNTS
+// NOTE: power-down mode (PCON.PD) is deliberately not used, as only reset or an external interrupt ends it, and on this board neither the key-matrix rows nor the host clock line
+//      reach INT0/INT1 (P3.2 and P3.3 drive columns 10 and 11). The host clock is not an interrupt source either, so a request-to-send may wait up to one 10ms interval to be noticed,
+//      which still falls within the 15ms the PS/2 protocol allows the device to begin clocking.
+void sleepUntilTick(void){
+    // the remaining counts until Timer 2 overflows is the time about to be spent asleep
+    unsigned int remaining = 0xffff - readTimer2() + 1;
+    if( remaining < SLEEP_MARGIN )
+        return;
+    unsigned char tick = TICK_COUNT;
+    SLEEP_COUNTS += remaining;
+    // enter idle mode, the CPU halts here until the Timer 2 interrupt (peripherals and timers keep running), going back to idle if another interrupt (the UART's) ended it first
+    do{
+        PCON |= IDL;
+    }while( tick == (unsigned char)TICK_COUNT );
+}//end_sleepUntilTick
+
 // function that utilizes the 8051's in-circuit Timer 0 to ensure an accurate hardware driven delay (accurate for values greater than 30 microseconds)
 // NOTE: a 12 or 24 MHz crystal oscilliator must be used to drive the MCU for this delay function to be accurate
 void delay_us(int us){
-// check if 24 MHz clock is defined as in use, and double 'us' if so to accomodate for the faster clock speed
-#if CLOCK == 24
-    us += us;
+// scale 'us' to timer counts if the timer counts faster than once a microsecond (a 24 MHz clock, X2 mode, or both)
+#if COUNTS_PER_US > 1
+    us *= COUNTS_PER_US;
 #endif
     // calculate hex to load into timer high/low bytes
     unsigned int pause = 0xffff - us;
     // set timer mode to 16-bit, load timer high/low bytes with pause
-    TMOD = 0x01;
+    TMOD = (TMOD & 0xf0) | 0x01; // (leaving Timer 1's mode as it is)
     TL0 = pause & 0xff;
     TH0 = pause >> 8;
     TR0 = 1; // start timer
@@ -91,104 +991,745 @@ void delay_us(int us){
     TF0 = 0; // clear flag
 }//end_delay_us
 
-// function to transmit keycode over data line to host in unison with clock pulses
-// NOTE: if a 12 MHz system clock is used, the device-to-host transmission speed will drop lower than the PS/2 spec unless up/down time is modified to zero
-void transmit(unsigned int keycode){
+// function to start Timer 0 setting its overflow flag every half-period of a PS/2 clock pulse, given the reload for it (see HALF_RELOAD())
+void startEdges(unsigned char reload){
+    TR0 = 0;
+    TMOD = (TMOD & 0xf0) | 0x02; // 8-bit auto-reload (leaving Timer 1's mode as it is)
+    TH0 = reload;
+    TL0 = reload;
+    TF0 = 0;
+    TR0 = 1;
+}//end_startEdges
+
+// function to stop Timer 0 once a byte has been clocked, leaving it for delay_us()
+void stopEdges(void){
+    TR0 = 0;
+    TF0 = 0;
+}//end_stopEdges
+
+// function to make the given layer of KEY_MAP the active one for keys pressed from now on
+void setLayer(unsigned char layer){
+    LAYER = layer;
+    KEY_LAYER = KEY_MAP[layer];
+}//end_setLayer
+
+// function to count a link error (a resend request or a transmission inhibited part way through), falling back to a slower link speed once errors exceed LINK_ERROR_LIMIT in a window
+void linkError(void){
+    // start a new window if the last one has run out
+    if( elapsedSince(LINK_WINDOW_STAMP) >= LINK_WINDOW ){
+        LINK_WINDOW_STAMP = ELAPSED_TIME;
+        LINK_ERRORS = 0;
+    }
+    if( ++LINK_ERRORS > LINK_ERROR_LIMIT && LINK_SPEED < LINK_SPEEDS - 1 ){
+        LINK_SPEED++;
+        LINK_HALF = LINK_HALF_TIMES[LINK_SPEED];
+        LINK_ERRORS = 0;
+    }
+}//end_linkError
+
+// function to drive a single key-matrix column high, columns 0 to 7 being Port 1 (bits 0 to 7) and columns 8 to 13 being Port 3 (bits 0 to 5)
+void selectColumn(unsigned char column){
+#if UART
+    // column 9 is rewired to P3.6, and P3.1 left high for the UART to drive TXD
+    if( column < 8 ){
+        P3 = 0x02;
+        P1 = 0x01 << column;
+    }else{
+        P1 = 0x00;
+        P3 = (column == 9 ? 0x40 : 0x01 << (column - 8)) | 0x02;
+    }
+#else
+    if( column < 8 ){
+        P3 = 0x00;
+        P1 = 0x01 << column;
+    }else{
+        P1 = 0x00;
+        P3 = 0x01 << (column - 8);
+    }
+#endif
+}//end_selectColumn
+
+// function to transmit keycode over data line to host in unison with clock pulses, returning 0 if the host inhibited the transmission before the stop bit's clock (the byte must then be sent again)
+// NOTE: each half of a clock pulse is timed by Timer 0 from LINK_HALF (see LINK_SPEEDS and HALF_RELOAD())
+unsigned char transmit(unsigned int keycode){
     char bkup = P2; // for maintaining state of P2 prior to transmission (need only if LEDs are connected to bits of Port 2)
     LAST_BYTE = keycode;
     // prepare start bit on keycode being sent (start bit is always zero)
     keycode <<= 1;
     // loop over byte, transmitting it one bit at a time in little endian format over Port 2
-    unsigned int index = 0x00;
+    unsigned char index = 0x00;
+    startEdges(LINK_HALF);
     while( index < 11 ){
-        // set bit for transmission on Port 2
+        // the clock line is released high between pulses, so the host holding it low before any of the 11 clocks means it is inhibiting (or about to send a command), and the
+        // host discards a byte inhibited before its 11th clock, so the byte is abandoned to be sent again
+        if( !(P2 & 0x02) ){
+            P2 = (0xfc & bkup) | 0x03; // data and clock released high, previous state of other Port 2 bits restored
+            stopEdges();
+            TX_ABORTS++;
+            linkError();
+            return 0;
+        }
+        // set bit for transmission on Port 2 while the clock is high
         P2 = keycode | 0x02; // 0000 0011
-        // latch clock on falling edge where Port 0.1 is used as clock
-        P2_1 ^= 1; // 0000 0010
         keycode >>= 1;
         index++;
-        delay_us(16); // downtime
-        P2_1 ^= 1; // 0000 0010
-        delay_us(14); // uptime
+        // latch clock on falling edge where Port 0.1 is used as clock, at the end of the uptime (the first half-period being the start bit's setup time)
+        EDGE_LOW();  // uptime
+        EDGE_HIGH(); // downtime
     }
+    EDGE_WAIT(); // uptime of the stop bit's clock
+    stopEdges();
     P2 |= 0x03; // 0000 0011 // data and clock reset high
     P2 |= (0xf8 & bkup); // previous state of other Port 2 bits restored
+    LINK_BYTES++;
+    TRACE(TRACE_BYTE, LAST_BYTE);
+    return 1;
 }//end_transmit
 
-// function to receive commands from host device
+// function to receive commands from host device, returning -1 if the host does not start sending within RECEIVE_TIMEOUT intervals
+// NOTE: expects to be called with interrupts disabled, but has them enabled while waiting for the host to start (so the wait can be timed and the watchdog fed)
 int receive(void){
     int buffer = 0;
+    unsigned char stamp = ELAPSED_TIME; // for time-stamping the start of the wait
     // wait for clock to go high and data to go low
-    while( !((P2 & 0x02) && !(P2 & 0x01)) );
+    EA = 1; // enable interrupts
+    while( !((P2 & 0x02) && !(P2 & 0x01)) ){
+        FEED_WATCHDOG();
+        if( elapsedSince(stamp) > RECEIVE_TIMEOUT ){
+            EA = 0; // disable interrupts
+            return -1;
+        }
+    }
+    EA = 0; // disable interrupts
     // loop to receive data from host (8 data bits and 1 parity bit)
-    unsigned int index = 0;
+    unsigned char index = 0;
+    startEdges(RECEIVE_HALF);
     while( index < 10 ){
-        P2_1 ^= 1; // lower clock
-        delay_us(16); // downtime
-        P2_1 ^= 1; // raise clock
-        buffer |= ((P2 & 0x01) << (index++)); // acquire data bit set by host
-        delay_us(16); // uptime
+        EDGE_LOW();  // uptime
+        EDGE_HIGH(); // downtime
+        // acquire data bit set by host as the clock rises, shifting in from the top (bit 0 ends up the first received)
+        buffer >>= 1;
+        if( P2 & 0x01 )
+            buffer |= 0x0200;
+        index++;
     }
     // send ack bit back to host by setting data low and pulsing the clock
-    P2_0 = 0;  // 1111 1110
-    P2_1 ^= 1; // lower clock
-    delay_us(16); // downtime
-    P2 |= 0x03; // raise clock and data
+    P2_0 = 0;    // 1111 1110
+    EDGE_LOW();  // uptime
+    EDGE_HIGH(); // downtime
+    stopEdges();
+    P2 |= 0x03; // release data (and clock)
+    TRACE(TRACE_HOST, buffer);
     return buffer;
 }//end_receive
 
-// function to prepare appropriate keycode to send based on code length and if pressed/released as indicated by keycode parameter (1 is pressed state, 0 is released state)
-void sendCode(uint32_t keycode, char keyState){
+// function to start sending a key's make (keyState non-zero) or break (keyState zero) byte sequence from KEY_SEQUENCES, the bytes themselves going out one at a time from serviceQueue()
+void loadSequence(unsigned char key, char keyState){
+    // the make sequence is sequence 2 * key, the break sequence follows it, and each ends where the next starts
+    unsigned char sequence = (key << 1) | !keyState;
+    TX_INDEX = KEY_SEQUENCE_INDEX[sequence];
+    TX_END = KEY_SEQUENCE_INDEX[sequence + 1];
+}//end_loadSequence
+
+// function to read TICK_COUNT whole, as the Timer 2 interrupt may update it between its two bytes
+unsigned int readTicks(void){
+    unsigned int ticks;
+    do{
+        ticks = TICK_COUNT;
+    }while( ticks != TICK_COUNT );
+    return ticks;
+}//end_readTicks
+
+// function to find the slot of key statistics counting for the given key-matrix position, returning KEY_STAT_SLOTS if there is none
+unsigned char keyStatSlot(unsigned char position){
+    unsigned char slot;
+    for(slot = 0; slot < KEY_STAT_SLOTS; slot++){
+        if( KEY_STAT_BOUNCES[slot] && KEY_STAT_POSITIONS[slot] == position )
+            break;
+    }
+    return slot;
+}//end_keyStatSlot
+
+// function to count a bounce rejected at the given key-matrix position, giving the key a slot of key statistics if it has none
+void recordBounce(unsigned char position){
+    unsigned char slot = keyStatSlot(position);
+    unsigned char index;
+    if( KEY_BOUNCES != 0xffff )
+        KEY_BOUNCES++;
+    TRACE(TRACE_BOUNCE, position);
+    if( slot == KEY_STAT_SLOTS ){
+        // take over the slot with the fewest bounces (an unused one having none), keeping its count so the key starts one bounce above it and
+        //      a one-off bounce cannot push a key with more bounces out of its slot
+        slot = 0;
+        for(index = 1; index < KEY_STAT_SLOTS; index++){
+            if( KEY_STAT_BOUNCES[index] < KEY_STAT_BOUNCES[slot] )
+                slot = index;
+        }
+        KEY_STAT_POSITIONS[slot] = position;
+        KEY_STAT_PRESSES[slot] = 0;
+        KEY_STAT_HOLDS[slot] = 0;
+        KEY_STAT_STAMPS[slot] = readTicks(); // a key already held has its hold timed from here
+    }
+    if( KEY_STAT_BOUNCES[slot] != 0xff )
+        KEY_STAT_BOUNCES[slot]++;
+}//end_recordBounce
+
+// function to count a press of the key at the given key-matrix position, time-stamping it if the key has a slot of key statistics
+void recordPress(unsigned char position){
+    unsigned char slot = keyStatSlot(position);
+    KEY_PRESSES++;
+    if( slot == KEY_STAT_SLOTS )
+        return;
+    if( KEY_STAT_PRESSES[slot] != 0xffff )
+        KEY_STAT_PRESSES[slot]++;
+    KEY_STAT_STAMPS[slot] = readTicks();
+}//end_recordPress
+
+// function to bring the longest hold of the given slot of key statistics up to date with the hold since its key was last pressed
+void updateHold(unsigned char slot){
+    unsigned int hold = readTicks() - KEY_STAT_STAMPS[slot]; // for the intervals the key has been held
+    // saturate at 0x8000 intervals, holding the time-stamp back so the hold of a key that stays down does not wrap round
+    if( hold > 0x8000 ){
+        hold = 0x8000;
+        KEY_STAT_STAMPS[slot] = readTicks() - 0x8000;
+    }
+    if( hold > KEY_STAT_HOLDS[slot] )
+        KEY_STAT_HOLDS[slot] = hold;
+}//end_updateHold
+
+// function to bring the longest holds of the keys with slots of key statistics that are held right now up to date, returning a bit per slot whose key is held
+unsigned char updateHolds(void){
+    unsigned char slot, position;
+    unsigned char held = 0;
+    for(slot = 0; slot < KEY_STAT_SLOTS; slot++){
+        position = KEY_STAT_POSITIONS[slot];
+        if( KEY_STAT_BOUNCES[slot] && (KEY_STATES[position / 6] & (0x01 << (position % 6))) ){
+            updateHold(slot);
+            held |= 0x01 << slot;
+        }
+    }
+    return held;
+}//end_updateHolds
+
+// function to take the release of the key at the given key-matrix position, keeping its longest hold if the key has a slot of key statistics
+void recordRelease(unsigned char position){
+    unsigned char slot = keyStatSlot(position);
+    if( slot == KEY_STAT_SLOTS )
+        return;
+    updateHold(slot);
+}//end_recordRelease
+
+#if GAMING
+// function to lock a key out once its change has been acted on, ignoring it until its lockout generation is cleared
+void lockKey(unsigned char column, unsigned char mask){
+    // the generation is read once, so the key is locked in the same generation that is flagged even if a tick comes in between
+    unsigned char generation = ELAPSED_TIME & 0x01;
+    KEY_LOCKED[generation][column] |= mask;
+    KEY_LOCKED_ANY |= 0x01 << generation;
+}//end_lockKey
+#endif
+
+// function to debounce a key, given whether its reading differs from its state, returning non-zero once a change is to be acted on (a change rejected as a bounce is
+// counted against the key's position in the key-matrix)
+unsigned char debounce(unsigned char column, unsigned char mask, unsigned char position, unsigned char changed){
+#if GAMING
+    // eager: act on the first edge of a change, the key then being locked out by lockKey() once the change has gone in
+    if( !changed )
+        return 0;
+    if( (KEY_LOCKED[0][column] | KEY_LOCKED[1][column]) & mask ){
+        recordBounce(position);
+        return 0;
+    }
+    return 1;
+#else
+    // deferred: act on a change only once it reads the same on two visits in a row (a scan pass apart), a reading that reverts in between being a bounce
+    if( !changed ){
+        if( KEY_PENDING[column] & mask )
+            recordBounce(position);
+        KEY_PENDING[column] &= ~mask;
+        return 0;
+    }
+    if( KEY_PENDING[column] & mask ){
+        KEY_PENDING[column] &= ~mask;
+        return 1;
+    }
+    KEY_PENDING[column] |= mask;
+    return 0;
+#endif
+}//end_debounce
+
+// function to discard any queued key events along with a pending repeat and the rest of the event being sent
+void clearQueue(void){
+    EVENT_TAIL = EVENT_HEAD;
+    REPEAT_PENDING = 0;
+    TX_INDEX = TX_END;
+    LATENCY_PENDING = 0;
+#if GAMING
+    EVENT_PRESSES = 0;
+#endif
+}//end_clearQueue
+
+// function to queue a key event time-stamped as detected now, returning 0 if the queue is full (the caller then leaves the key's state untouched so the change is picked up again on a later pass)
+unsigned char queueEvent(unsigned char event){
+    unsigned char next = (EVENT_HEAD + 1) & (EVENT_QUEUE_SIZE - 1);
+    if( next == EVENT_TAIL ){
+        QUEUE_OVERFLOWS++;
+        return 0;
+    }
+#if GAMING
+    // a press goes out ahead of any queued releases (behind the presses already ahead of them), unless a release of the same key is still queued, which has to go first
+    // NOTE: a modifier release is never overtaken (a press going out ahead of a shift release would change the character typed), so queueing one moves the front up to it
+    if( !(event & EVENT_BREAK) ){
+        unsigned char position = (EVENT_TAIL + EVENT_PRESSES) & (EVENT_QUEUE_SIZE - 1);
+        unsigned char index;
+        for(index = position; index != EVENT_HEAD; index = (index + 1) & (EVENT_QUEUE_SIZE - 1)){
+            if( EVENT_QUEUE[index] == (event | EVENT_BREAK) )
+                break;
+        }
+        if( index == EVENT_HEAD ){
+            // shift the queued releases back by one to make room
+            for(index = EVENT_HEAD; index != position; index = (index - 1) & (EVENT_QUEUE_SIZE - 1)){
+                EVENT_QUEUE[index] = EVENT_QUEUE[(index - 1) & (EVENT_QUEUE_SIZE - 1)];
+                EVENT_STAMPS[index] = EVENT_STAMPS[(index - 1) & (EVENT_QUEUE_SIZE - 1)];
+            }
+            EVENT_QUEUE[position] = event;
+            EVENT_STAMPS[position] = latencyStamp();
+            TRACE(TRACE_KEY, event);
+            EVENT_HEAD = next;
+            if( ((EVENT_HEAD - EVENT_TAIL) & (EVENT_QUEUE_SIZE - 1)) > QUEUE_HIGH_WATER )
+                QUEUE_HIGH_WATER = (EVENT_HEAD - EVENT_TAIL) & (EVENT_QUEUE_SIZE - 1);
+            EVENT_PRESSES++;
+            REPEAT_PENDING = 0;
+            return 1;
+        }
+    }
+#endif
+    EVENT_QUEUE[EVENT_HEAD] = event;
+    EVENT_STAMPS[EVENT_HEAD] = latencyStamp();
+    TRACE(TRACE_KEY, event);
+    EVENT_HEAD = next;
+#if GAMING
+    if( (event & EVENT_BREAK) && KEY_MODIFIER(event & ~EVENT_BREAK) )
+        EVENT_PRESSES = (EVENT_HEAD - EVENT_TAIL) & (EVENT_QUEUE_SIZE - 1);
+#endif
+    if( ((EVENT_HEAD - EVENT_TAIL) & (EVENT_QUEUE_SIZE - 1)) > QUEUE_HIGH_WATER )
+        QUEUE_HIGH_WATER = (EVENT_HEAD - EVENT_TAIL) & (EVENT_QUEUE_SIZE - 1);
+    REPEAT_PENDING = 0; // a repeat still waiting behind a fresh key change is stale, the typematic key is re-evaluated by the change anyway
+    return 1;
+}//end_queueEvent
+
+// function for the room left in the event queue, in events
+unsigned char queueRoom(void){
+    return (EVENT_TAIL - EVENT_HEAD - 1) & (EVENT_QUEUE_SIZE - 1);
+}//end_queueRoom
+
+// function to look up the set 3 attributes of the given key (KEY_NO_BREAK and KEY_NO_REPEAT)
+unsigned char keyAttributes(unsigned char key){
+    unsigned char slot;
+    if( key != K_NONE ){
+        for(slot = 0; slot < KEY_ATTRIBUTE_SLOTS; slot++){
+            if( KEY_ATTRIBUTE_KEYS[slot] == key )
+                return ((KEY_SLOT_NO_BREAK >> slot) & 0x01 ? KEY_NO_BREAK : 0) | ((KEY_SLOT_NO_REPEAT >> slot) & 0x01 ? KEY_NO_REPEAT : 0);
+        }
+    }
+    return KEY_ATTRIBUTES_ALL;
+}//end_keyAttributes
+
+// function to make a key just pressed the typematic key, taking over repetition from any key still held (as a real PS/2 keyboard does)
+// NOTE: keys set not to repeat and make-only keys such as pause (those with an empty break sequence) never repeat, but still end another key's repetition
+void startTypematic(unsigned char key){
+    if( !(keyAttributes(key) & KEY_NO_REPEAT) && KEY_SEQUENCE_INDEX[(key << 1) + 1] != KEY_SEQUENCE_INDEX[(key << 1) + 2] ){
+        TYPEMATIC_KEY = key;
+        TYPEMATIC_STAMP = ELAPSED_TIME;
+        TYPEMATIC_REPEATING = 0;
+    }else{
+        TYPEMATIC_KEY = K_NONE;
+    }
+}//end_startTypematic
+
+// function to find the index in DUAL_KEYS of a key identifier, returning DUAL_NONE if it is not a dual-role key
+unsigned char dualRole(unsigned char key){
+    unsigned char dual;
+    for(dual = 0; dual < DUAL_ROLES; dual++){
+        if( DUAL_KEYS[dual] == key )
+            return dual;
+    }
+    return DUAL_NONE;
+}//end_dualRole
+
+// function to decide the undecided dual-role key is held, pressing its hold role, returning 0 if the event queue is full (the key is then left undecided)
+unsigned char holdDual(void){
+    unsigned char key = DUAL_HOLDS[DUAL_PENDING];
+    if( key == K_FN ){
+        setLayer(1);
+    }else{
+        if( !queueEvent(key) )
+            return 0;
+        startTypematic(key);
+    }
+    DUAL_HOLDING |= 0x01 << DUAL_PENDING;
+    DUAL_PENDING = DUAL_NONE;
+    return 1;
+}//end_holdDual
+
+// function to release a dual-role key, sending its tap role if its role was still undecided or releasing its hold role, returning 0 if the event queue is too full
+// (the release is then picked up again on a later pass)
+unsigned char releaseDual(unsigned char dual){
+    unsigned char key;
+    if( dual == DUAL_PENDING ){
+        key = DUAL_TAPS[dual];
+        if( queueRoom() < 2 )
+            return 0;
+        queueEvent(key);
+        if( !(keyAttributes(key) & KEY_NO_BREAK) )
+            queueEvent(EVENT_BREAK | key);
+        TYPEMATIC_KEY = K_NONE; // a tap ends another key's repetition like any other press
+        DUAL_PENDING = DUAL_NONE;
+    }else if( DUAL_HOLDING & (0x01 << dual) ){
+        key = DUAL_HOLDS[dual];
+        if( key == K_FN )
+            setLayer(0);
+        else if( !(keyAttributes(key) & KEY_NO_BREAK) && !queueEvent(EVENT_BREAK | key) )
+            return 0;
+        if( TYPEMATIC_KEY == key )
+            TYPEMATIC_KEY = K_NONE;
+        DUAL_HOLDING &= ~(0x01 << dual);
+    }
+    return 1;
+}//end_releaseDual
+
+// function to time-stamp the link going quiet (a stop bit sent or an inhibit ended), and require the given gap in Timer 2 counts from it before the next byte
+void stampGap(unsigned int gap){
+    // re-read if Timer 2 overflowed between reading the tick and the count
+    do{
+        TX_TICK = TICK_COUNT;
+        TX_COUNT = readTimer2();
+    }while( TX_TICK != (unsigned char)TICK_COUNT );
+    TX_GAP = gap;
+}//end_stampGap
+
+// function to count a key change's press-to-host latency (in units of 16 Timer 2 counts) in its LATENCY_HISTOGRAM bucket
+void recordLatency(unsigned int latency){
+    unsigned char bucket = 0;
+    latency >>= LATENCY_FLOOR_SHIFT;
+    while( latency && bucket < LATENCY_BUCKETS - 1 ){
+        latency >>= 1;
+        bucket++;
+    }
+    LATENCY_HISTOGRAM[bucket]++;
+}//end_recordLatency
+
+// function to hold the time-stamps of the key changes waiting to be sent at no more than half the wrap of latencyStamp() old, keeping their latencies from wrapping round
+// while the host inhibits for longer than the wrap (called at least once per 10ms interval meanwhile, which is far less than the remaining half a wrap)
+void ageStamps(void){
+    unsigned int oldest = latencyStamp() - 0x8000; // for the stamp of a change detected half a wrap ago
+    unsigned char index;
+    for(index = EVENT_TAIL; index != EVENT_HEAD; index = (index + 1) & (EVENT_QUEUE_SIZE - 1)){
+        if( (EVENT_STAMPS[index] - oldest) & 0x8000 )
+            EVENT_STAMPS[index] = oldest;
+    }
+    if( LATENCY_PENDING && ((LATENCY_STAMP - oldest) & 0x8000) )
+        LATENCY_STAMP = oldest;
+}//end_ageStamps
+
+// function to track the host inhibiting communication by holding the clock low, during which key changes are still scanned and queued (only a repeat goes stale and is dropped)
+// NOTE: once the host lets go, the backlog goes out back to back, the first byte only 50us after the clock is released instead of a full BREAK period
+void trackInhibit(void){
+    if( !(P2 & 0x02) ){
+        if( !INHIBITED ){
+            HOST_INHIBITS++;
+            TRACE(TRACE_INHIBIT, 1);
+        }
+        INHIBITED = 1;
+        REPEAT_PENDING = 0;
+        ageStamps();
+    }else if( INHIBITED ){
+        INHIBITED = 0;
+        TRACE(TRACE_INHIBIT, 0);
+        stampGap(INHIBIT_GAP_COUNTS);
+        if( EVENT_HEAD != EVENT_TAIL || TX_INDEX != TX_END ){
+            FLUSH_PENDING = 1;
+            FLUSH_STAMP = ELAPSED_TIME;
+        }
+    }
+}//end_trackInhibit
+
+// function to frame a data byte for transmit(), adding its odd parity bit (bit 8) and stop bit (bit 9)
+unsigned int frameByte(unsigned char data){
+    unsigned char ones = data;
+    // fold the byte onto itself so bit 0 ends up as the parity of all 8 bits
+    ones ^= ones >> 4;
+    ones ^= ones >> 2;
+    ones ^= ones >> 1;
+    return 0x0200 | ((unsigned int)(~ones & 0x01) << 8) | data;
+}//end_frameByte
+
+// function to send the next outgoing byte, presses and releases always go first (in the order detected) and a typematic repeat only goes out once none are queued
+// NOTE: only one byte is sent per call, so the key-matrix keeps being scanned and host commands keep being serviced between the bytes of long sequences such as macros.
+//      A host request therefore waits at most for the byte in flight (about 1ms), or none at all if the host pulls the clock low mid-byte, as transmit() then abandons the
+//      byte to be resent after the command. Together with the host RX task running every scheduler round and the 10ms idle-mode wake up, the keyboard starts clocking in a
+//      command within about 1ms while active and 10ms while idle, well inside the 20ms response window the PS/2 protocol expects.
+//      The BREAK period is timed from the previous stop bit instead of being waited out after every byte, so the columns scanned in between overlap it and a
+//      sequence still streams at the full link rate (roughly 790 bytes per second at 24 MHz, the same pacing sendCode() kept while blocking everything else).
+void serviceQueue(void){
+    // once the event in progress has been sent, move on to the next one
+    if( TX_INDEX == TX_END ){
+        if( EVENT_HEAD != EVENT_TAIL ){
+            loadSequence(EVENT_QUEUE[EVENT_TAIL] & ~EVENT_BREAK, !(EVENT_QUEUE[EVENT_TAIL] & EVENT_BREAK));
+            LATENCY_PENDING = 1;
+            LATENCY_STAMP = EVENT_STAMPS[EVENT_TAIL];
+            EVENT_TAIL = (EVENT_TAIL + 1) & (EVENT_QUEUE_SIZE - 1);
+#if GAMING
+            if( EVENT_PRESSES )
+                EVENT_PRESSES--;
+#endif
+        }else if( REPEAT_PENDING ){
+            REPEAT_PENDING = 0;
+            LATENCY_PENDING = 0;
+            loadSequence(TYPEMATIC_KEY, 1);
+        }
+        // sequences may be empty (such as the break of a make-only key), leaving nothing to send
+        if( TX_INDEX == TX_END )
+            return;
+    }
+#if TRANSPORT == TRANSPORT_UART
+    // the UART has no gap between bytes or host inhibit to wait out, so the sequence is buffered as far as there is room (the latency measured is to the last byte buffered)
+    while( TX_INDEX != TX_END && uartRoom() ){
+        uartPut(KEY_SEQUENCES[TX_INDEX]);
+        TX_INDEX++;
+        LINK_BYTES++;
+    }
+    uartStart();
+#else
+    // until the gap since the last byte (or since the host ended an inhibit) has passed, leave the byte for a later round
+    if( countsSince(TX_TICK, TX_COUNT) < TX_GAP )
+        return;
     EA = 0; // disable interrupts
-    // if the keyState is non-zero, this indicates to send the code for pressing the key
-    if( keyState ){
-        // check if extended code
-        if( (keycode & 0xff0000) == 0xe00000 ){
-            // transmit extension, then keycode
-            transmit(EXT);
-            delay_us(BREAK); // BREAK period between code and extension/state transmission
-            transmit(keycode);
-            delay_us(BREAK);
-        }else{
-            transmit(keycode);
-            delay_us(BREAK);
+    // only move on to the next byte once this one has gone out whole
+    if( transmit(frameByte(KEY_SEQUENCES[TX_INDEX])) ){
+#if TRANSPORT & TRANSPORT_UART
+        // mirror it on the UART, which drains far faster than PS/2 sends (a byte finding no room is left out of the UART's copy)
+        if( uartRoom() ){
+            uartPut(KEY_SEQUENCES[TX_INDEX]);
+            uartStart();
         }
-    }else{ // else the keyState is zero, indicating to send the code for releasing a key
-        // check if extended code
-        if( (keycode & 0xff0000) == 0xe00000 ){
-            // transmit extension, then release code, then finally keycode
-            transmit(EXT);
-            delay_us(BREAK);
-            transmit(REL);
-            delay_us(BREAK);
-            transmit(keycode);
-            delay_us(BREAK);
-        }else{
-            // transmit release code, then keycode
-            transmit(REL);
-            delay_us(BREAK);
-            transmit(keycode);
-            delay_us(BREAK);
+#endif
+        TX_INDEX++;
+    }
+    EA = 1; // enable interrupts (before measuring, so a Timer 2 overflow during the byte has been counted in TICK_COUNT)
+#endif
+    // once the last byte of a key change is out, fold how long it took from detection into the latency histogram
+    if( LATENCY_PENDING && TX_INDEX == TX_END ){
+        LATENCY_PENDING = 0;
+        recordLatency(latencyStamp() - LATENCY_STAMP);
+    }
+    stampGap(BREAK_COUNTS);
+    // once everything queued during an inhibit has gone out, note how long the host waited for it
+    if( FLUSH_PENDING && EVENT_HEAD == EVENT_TAIL && TX_INDEX == TX_END ){
+        FLUSH_PENDING = 0;
+        if( elapsedSince(FLUSH_STAMP) > FLUSH_DELAY_MAX )
+            FLUSH_DELAY_MAX = elapsedSince(FLUSH_STAMP);
+    }
+}//end_serviceQueue
+
+// function to set (or, with noBreak/noRepeat zero, clear) the attributes of every key, as scan code set 3 commands 0xF7 - 0xFA do
+void setAllKeyAttributes(unsigned char noBreak, unsigned char noRepeat){
+    unsigned char slot;
+    KEY_ATTRIBUTES_ALL = (noBreak ? KEY_NO_BREAK : 0) | (noRepeat ? KEY_NO_REPEAT : 0);
+    // every key now has these, so the keys named before give up their slots
+    for(slot = 0; slot < KEY_ATTRIBUTE_SLOTS; slot++)
+        KEY_ATTRIBUTE_KEYS[slot] = K_NONE;
+    KEY_SLOT_NO_BREAK = 0;
+    KEY_SLOT_NO_REPEAT = 0;
+}//end_setAllKeyAttributes
+
+// function to apply the attribute of the pending set 3 command (0xFB - 0xFD) to the key with the given scan code set 3 code
+void setKeyAttribute(unsigned char code){
+    unsigned char key, slot;
+    // find the key by its set 3 code (codes the keyboard has no key for are acknowledged and ignored)
+    for(key = 1; key < KEY_SET3_COUNT; key++){
+        if( KEY_SET3_CODES[key] == code )
+            break;
+    }
+    if( key == KEY_SET3_COUNT )
+        return;
+    // find the key's slot, or else an unused one
+    for(slot = 0; slot < KEY_ATTRIBUTE_SLOTS; slot++){
+        if( KEY_ATTRIBUTE_KEYS[slot] == key )
+            break;
+    }
+    if( slot == KEY_ATTRIBUTE_SLOTS ){
+        for(slot = 0; slot < KEY_ATTRIBUTE_SLOTS; slot++){
+            if( KEY_ATTRIBUTE_KEYS[slot] == K_NONE )
+                break;
         }
-    }//end_if_else_keyState
-    EA = 1; // enable interrupts
-}//end_sendCode
+        if( slot == KEY_ATTRIBUTE_SLOTS )
+            return;
+        KEY_ATTRIBUTE_KEYS[slot] = key;
+    }
+    // 0xFB typematic only (no break), 0xFC make/release (no repeat), 0xFD make only (neither)
+    if( KEY_ATTRIBUTE_COMMAND == 0xfc )
+        KEY_SLOT_NO_BREAK &= ~(0x01 << slot);
+    else
+        KEY_SLOT_NO_BREAK |= (0x01 << slot);
+    if( KEY_ATTRIBUTE_COMMAND == 0xfb )
+        KEY_SLOT_NO_REPEAT &= ~(0x01 << slot);
+    else
+        KEY_SLOT_NO_REPEAT |= (0x01 << slot);
+}//end_setKeyAttribute
+
+// function to restore the keyboard's power-on state and check the key-matrix for stuck keys, the basic assurance test run at power-on and on a reset command
+// NOTE: a key found active is recorded as already held rather than failing the test, so neither a stuck switch nor a key held through power-on emits codes until it is
+//      released and pressed again (this also clears whatever the key state held before, which at power-on would otherwise be uninitialized RAM)
+void selfTest(void){
+    unsigned char column, row;
+    unsigned char held = 0; // for the number of keys found held
+    ENABLE = 1;
+    REPEAT_RATE = DEFAULT_REPEAT_RATE;
+    REPEAT_DELAY = DEFAULT_REPEAT_DELAY;
+    TYPEMATIC_KEY = K_NONE;
+    DUAL_PENDING = DUAL_NONE;
+    DUAL_HOLDING = 0;
+    setAllKeyAttributes(0, 0);
+    KEY_ATTRIBUTE_COMMAND = 0;
+    setLayer(0);
+    clearQueue();
+    // start the scan task on a fresh pass, as the columns are about to be driven here
+    SCAN_COLUMN = 14;
+    READ_COLUMN = 0xff;
+    for(row = 0; row < KEY_TEST_HELD_SLOTS; row++)
+        KEY_TEST_HELD[row] = 0xff;
+    for(column = 0; column < 14; column++){
+        selectColumn(column);
+        delay_us(COLUMN_SETTLE);
+        KEY_STATES[column] = P0 & 0x3f;
+        KEY_LAYERS[column] = 0;
+        for(row = 0; row < 6; row++){
+            if( (KEY_STATES[column] & (0x01 << row)) && held < KEY_TEST_HELD_SLOTS )
+                KEY_TEST_HELD[held++] = column * 6 + row;
+        }
+#if !GAMING
+        KEY_PENDING[column] = 0;
+#endif
+    }
+}//end_selfTest
+
+// function to report the basic assurance test passed, waiting for the host to release the bus and retrying until the byte goes out whole
+void sendBAT(void){
+    unsigned char sent;
+    do{
+        while( (P2 & 0x03) != 0x03 )
+            FEED_WATCHDOG(); // the host may hold the bus for as long as it likes
+        EA = 0; // disable interrupts
+        sent = transmit(BAT);
+        EA = 1; // enable interrupts
+    }while( !sent );
+}//end_sendBAT
+
+// function to send a block of bytes as part of a vendor diagnostic dump, returning 0 if the host inhibited a byte (the rest of the dump is then abandoned, as the host has moved on)
+// NOTE: interrupts are re-enabled for the BREAK period between bytes, so a dump lasting the better part of 100ms does not hold up the 10ms time keeping
+unsigned char sendBlock(unsigned char *block, unsigned char length){
+    while( length-- ){
+        FEED_WATCHDOG(); // the whole dump takes far longer than a scheduler round
+        EA = 1; // enable interrupts
+        delay_us(BREAK);
+        EA = 0; // disable interrupts
+        if( !transmit(frameByte(*block++)) )
+            return 0;
+    }
+    return 1;
+}//end_sendBlock
+
+// function to stream the diagnostic snapshot described with VENDOR_DUMP, one block at a time
+void sendDump(void){
+    static __code unsigned char length = DUMP_LENGTH; // kept in code space, as a local whose address is taken would take a byte of RAM
+    unsigned int ticks = TICK_COUNT; // copied while interrupts are still disabled, as the timer interrupt keeps counting during the dump
+    if( sendBlock((unsigned char *)&length, 1)
+     && sendBlock((unsigned char *)LATENCY_HISTOGRAM, sizeof(LATENCY_HISTOGRAM))
+     && sendBlock((unsigned char *)&SCAN_TIME_MIN, 2)
+     && sendBlock((unsigned char *)&SCAN_TIME_MAX, 2)
+     && sendBlock(&QUEUE_HIGH_WATER, 1)
+     && sendBlock((unsigned char *)&QUEUE_OVERFLOWS, 2)
+     && sendBlock(&LINK_SPEED, 1)
+     && sendBlock((unsigned char *)&LINK_BYTES, 2)
+     && sendBlock((unsigned char *)&RESENDS, 2)
+     && sendBlock((unsigned char *)&TX_ABORTS, 2)
+     && sendBlock((unsigned char *)&HOST_INHIBITS, 2)
+     && sendBlock(&FLUSH_DELAY_MAX, 1)
+     && sendBlock((unsigned char *)&SCAN_PASSES, 2)
+     && sendBlock((unsigned char *)&ticks, 2)
+     && sendBlock((unsigned char *)&SLEEP_COUNTS, 4)
+     && sendBlock((unsigned char *)&BAT_TIME, 2)
+#if TASK_PROFILE
+     && sendBlock(KEY_STATES, 14) )
+        sendBlock((unsigned char *)TASK_TIMES, sizeof(TASK_TIMES));
+#else
+     )
+        sendBlock(KEY_STATES, 14);
+#endif
+}//end_sendDump
+
+// function to stream the key statistics described with VENDOR_KEY_STATS, one block at a time
+void sendKeyStats(void){
+    static __code unsigned char length = KEY_STATS_LENGTH;
+    unsigned char held = updateHolds(); // for a bit per slot whose key is held right now
+    if( sendBlock((unsigned char *)&length, 1)
+     && sendBlock((unsigned char *)&KEY_PRESSES, 4)
+     && sendBlock((unsigned char *)&KEY_BOUNCES, 2)
+     && sendBlock(KEY_STAT_POSITIONS, KEY_STAT_SLOTS)
+     && sendBlock(KEY_STAT_BOUNCES, KEY_STAT_SLOTS)
+     && sendBlock((unsigned char *)KEY_STAT_PRESSES, sizeof(KEY_STAT_PRESSES))
+     && sendBlock((unsigned char *)KEY_STAT_HOLDS, sizeof(KEY_STAT_HOLDS))
+     && sendBlock(&held, 1) )
+        sendBlock(KEY_TEST_HELD, KEY_TEST_HELD_SLOTS);
+}//end_sendKeyStats
+
+// function to start the measurements reported by sendDump() over
+void clearDump(void){
+    unsigned char bucket;
+    for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        LATENCY_HISTOGRAM[bucket] = 0;
+    SCAN_TIME_MIN = 0xffff;
+    SCAN_TIME_MAX = 0;
+    QUEUE_HIGH_WATER = 0;
+    QUEUE_OVERFLOWS = 0;
+    LINK_BYTES = 0;
+    RESENDS = 0;
+    TX_ABORTS = 0;
+    HOST_INHIBITS = 0;
+    FLUSH_DELAY_MAX = 0;
+    SCAN_PASSES = 0;
+    KEY_PRESSES = 0;
+    KEY_BOUNCES = 0;
+    for(bucket = 0; bucket < KEY_STAT_SLOTS; bucket++)
+        KEY_STAT_BOUNCES[bucket] = 0; // leaving the slot unused
+#if TASK_PROFILE
+    for(bucket = 0; bucket < TASK_COUNT; bucket++)
+        TASK_TIMES[bucket] = 0;
+#endif
+}//end_clearDump
 
 // function to interpret a given command and either send an expected response back to host or only follow command
 void followCommand(unsigned int command){
     command &= 0xff; // truncates command for below switch statement
     unsigned int arg; // for receiving bytes back from the host when necessary
+    // after a set 3 command for specific keys, every byte that is not a command names another key (as many as the host likes), so each is handled as it arrives
+    if( KEY_ATTRIBUTE_COMMAND ){
+        if( command < 0xed ){
+            setKeyAttribute(command);
+            transmit(ACK);      // acknowledge
+            return;
+        }
+        KEY_ATTRIBUTE_COMMAND = 0;
+    }
     switch( command ){
         case 0xed: // set LEDs
             transmit(ACK);      // acknowledge
             arg = receive();    // read argument byte from host
+            if( (int)arg < 0 )
+                break;          // the host never sent it
             transmit(ACK);      // acknowledge
-            // check state of CapsLock LED (bit 2), the only "lock-key" present on version 1.0 of this keyboard
-            if( (arg & 0x04) ){
-                P2_3 = 1; // set CapsLock LED
-            }else{
-                P2_3 = 0; // clear CapsLock LED // 1111 0111
-            }// other LEDs would be: bit 0 == ScrollLock, bit 1 == NumberLock, bit 3 == International purposes (unused in US KBs)
+            LED_STATE = arg;    // shown by the LED task
             break;
         case 0xee: // echo
             transmit(0x03ee);   // respond to host with an echo back
@@ -196,6 +1737,8 @@ void followCommand(unsigned int command){
         case 0xf0: // scan code set
             transmit(ACK);      // acknowledge
             arg = receive();    // read argument byte from host
+            if( (int)arg < 0 )
+                break;          // the host never sent it
             transmit(ACK);      // acknowledge
             // if the argument received is 0, respond with current scan code set (which is 0x02)
             if( !(arg & 0xff) )
@@ -211,6 +1754,8 @@ void followCommand(unsigned int command){
         case 0xf3: // set typematic delay / auto-repeat rate of keycodes
             transmit(ACK);      // acknowledge
             arg = receive();    // read the argument from host
+            if( (int)arg < 0 )
+                break;          // the host never sent it
             transmit(ACK);      // acknowledge
             // set requested repeat rate (bits 0-4 of arg, 000X-XXXX) // (1000 / REPEAT_RATE * 10) cps
             if( (arg & 0x1f) >= 0x18 && (arg & 0x1f) <= 0x1f )
@@ -240,30 +1785,60 @@ void followCommand(unsigned int command){
         case 0xf5: // disable (disables key-matrix scanning)
             transmit(ACK);      // acknowledge
             ENABLE = 0;
+            clearQueue();
             break;
         case 0xfe: // resend last byte
-            transmit(ACK);      // acknowledge
-            transmit(LAST_BYTE);// last byte sent (seems seldom to be called)
+            RESENDS++;
+            linkError();        // the host failed to receive the last byte
+            transmit(frameByte(LAST_BYTE));// last byte sent (framed again, as only its data bits are kept), without acknowledging first (an acknowledge would itself become the last byte sent)
             break;
         case 0xff: // reset
             transmit(ACK);      // acknowledge
-            delay_us(BREAK);    // brief delay for "simulating" a reset, but also to ensure reception
-            transmit(0x03aa);   // report BAT successful
+            delay_us(BREAK);    // brief delay to ensure reception
+            selfTest();         // run the basic assurance test
+            sendBAT();          // report BAT successful
             break;
-        // NOTE: commands F6-FD apply to scancode set 3 only. This keyboard firmware currently is hardcoded to scancode set 2, thus these commands can be ignored.
+        // NOTE: commands F7-FD apply to scancode set 3. This keyboard firmware still only sends scancode set 2, but the key attributes they set are applied to it all the same
+        //      (keys set to make only then send no break codes at all, sparing the link the traffic), with keys named by their scancode set 3 codes as the host expects.
         case 0xf6: // set default
+            transmit(ACK);      // acknowledge
+            REPEAT_RATE = DEFAULT_REPEAT_RATE;
+            REPEAT_DELAY = DEFAULT_REPEAT_DELAY;
+            setAllKeyAttributes(0, 0);
+            break;
         case 0xf7: // set all keys to typematic/autorepeat
+            transmit(ACK);      // acknowledge
+            setAllKeyAttributes(1, 0);
+            break;
         case 0xf8: // set all keys to make/release
+            transmit(ACK);      // acknowledge
+            setAllKeyAttributes(0, 1);
+            break;
         case 0xf9: // set all keys to make only
+            transmit(ACK);      // acknowledge
+            setAllKeyAttributes(1, 1);
+            break;
         case 0xfa: // set all keys to typematic/autorepeat/make/release
             transmit(ACK);      // acknowledge
+            setAllKeyAttributes(0, 0);
             break;
         case 0xfb: // set specific key to typematic/autorepeat only
         case 0xfc: // set specific key to make/release
         case 0xfd: // set specific key to make only
             transmit(ACK);      // acknowledge
-            arg = receive();    // read argument byte from host
+            KEY_ATTRIBUTE_COMMAND = command; // the keys follow as separate bytes
+            break;
+        case VENDOR_DUMP: // vendor diagnostic dump
+            transmit(ACK);      // acknowledge
+            sendDump();
+            break;
+        case VENDOR_CLEAR: // vendor diagnostic clear
             transmit(ACK);      // acknowledge
+            clearDump();
+            break;
+        case VENDOR_KEY_STATS: // vendor key statistics
+            transmit(ACK);      // acknowledge
+            sendKeyStats();
             break;
         default: // command unknown or reception error
             transmit(RE);   // resend
@@ -272,21 +1847,237 @@ void followCommand(unsigned int command){
     }//end_switch
 }//end_followCommand
 
+// function for the host RX task, receiving and following a command once the host requests to send (clock released high with data pulled low)
+void rxTask(void){
+    int command; // for the command received
+    if( (P2 & 0x03) == 0x02 ){
+        EA = 0; // disable interrupts
+        command = receive();
+        if( command >= 0 )
+            followCommand(command);
+        EA = 1; // enable interrupts
+    }
+}//end_rxTask
+
+// function for the link TX task, sending one outgoing byte per round (so a key change goes out without waiting for the rest of the pass), provided the host is not
+// inhibiting or requesting the bus (key changes during an inhibit are still scanned and queued, and flushed as soon as the host releases the clock)
+void txTask(void){
+    trackInhibit();
+    if( (P2 & 0x03) == 0x03 )
+        serviceQueue();
+}//end_txTask
+
+// function to time-stamp a column being driven, to time its settle from
+void stampSettle(void){
+    // re-read if Timer 2 overflowed between reading the tick and the count
+    do{
+        SETTLE_TICK = TICK_COUNT;
+        SETTLE_COUNT = readTimer2();
+    }while( SETTLE_TICK != (unsigned char)TICK_COUNT );
+}//end_stampSettle
+
+// function for the matrix scan task, driving one column at a time and reading its rows once COLUMN_SETTLE has passed (to be debounced by the debounce task)
+// NOTE: the next column is driven as soon as a column is read, so its settle overlaps the debounce and link tasks instead of being waited out. Each key is visited once
+//      per pass (roughly 1.6ms of scanning time) plus whatever time is spent on host commands, which are answered between columns rather than aborting the pass.
+void scanTask(void){
+    if( !ENABLE || READ_COLUMN != 0xff )
+        return;
+    // a pass starts at column 0, back to back while active and only every IDLE_PERIOD intervals while idle
+    if( SCAN_COLUMN == 14 ){
+        if( IDLE && elapsedSince(LAST_SCAN) < IDLE_PERIOD )
+            return;
+        LAST_SCAN = ELAPSED_TIME;
+        SCAN_STAMP = latencyStamp();
+        PASS_ACTIVE = 0;
+        SCAN_COLUMN = 0;
+        selectColumn(0);
+        stampSettle();
+        return;
+    }
+    // NOTE: SFR requires a max of 700 nano-seconds to set the Port data for valid output, the settle fixes the ghost bug (ie, parasitic capacitance in circuit causing
+    //      ghost key-presses in bottom row)
+    if( countsSince(SETTLE_TICK, SETTLE_COUNT) < SETTLE_COUNTS )
+        return;
+    // check 0.0 to 0.5 for active/past input
+    READING = P0 & 0x3f;
+    READ_COLUMN = SCAN_COLUMN;
+    if( ++SCAN_COLUMN < 14 ){
+        selectColumn(SCAN_COLUMN);
+        stampSettle();
+    }
+}//end_scanTask
+
+// function for the debounce task, acting on the keys of the column last read whose reading differs from their state once debounced
+// NOTE: only keys with debounce work to do are visited, those reading differently from their state or (in the default profile) still waiting on a second reading,
+//      found for the whole column at once from its bitmaps. A column of settled keys costs a single comparison, so the time spent here follows the keys changing
+//      rather than the size of the matrix (a pass of 84 settled keys comes to 14 comparisons instead of 84 calls to debounce()).
+void debounceTask(void){
+    unsigned char column = READ_COLUMN;
+    unsigned char row, key;
+    unsigned char mask, pressed; // for the bit of the row, and that bit as read
+    unsigned char candidates;    // for the rows with debounce work to do
+    unsigned char position;      // for the key's position in the key-matrix (column * 6 + row)
+    unsigned char dual;          // for the key's index in DUAL_KEYS (DUAL_NONE if it is not a dual-role key)
+    unsigned int passTime;       // for the time a scan pass took (in units of 16 Timer 2 counts)
+    if( column == 0xff )
+        return;
+    if( READING )
+        PASS_ACTIVE = 1;
+#if GAMING
+    candidates = READING ^ KEY_STATES[column];
+#else
+    candidates = (READING ^ KEY_STATES[column]) | KEY_PENDING[column];
+#endif
+    for(row = 0, mask = 0x01; candidates; row++, mask <<= 1){
+        if( !(candidates & mask) )
+            continue;
+        candidates &= ~mask;
+        pressed = READING & mask;
+        position = column * 6 + row;
+        if( !debounce(column, mask, position, !pressed != !(KEY_STATES[column] & mask)) )
+            continue;
+        // if the key was not priorly active, queue a press
+        if( pressed ){
+            // a key pressed while a dual-role key is undecided decides it is held first (so a key pressed under the Fn key is looked up on layer 1)
+            if( DUAL_PENDING != DUAL_NONE && !holdDual() )
+                continue;
+            key = KEY_LAYER[column][row];
+            dual = dualRole(key);
+            // a dual-role key sends nothing until its role is decided (see DUAL_ROLES)
+            if( dual != DUAL_NONE || queueEvent(key) ){
+                KEY_STATES[column] |= mask;
+                recordPress(position);
+                if( LAYER )
+                    KEY_LAYERS[column] |= mask;
+                else
+                    KEY_LAYERS[column] &= ~mask;
+                if( dual != DUAL_NONE ){
+                    DUAL_PENDING = dual;
+                    DUAL_STAMP = ELAPSED_TIME;
+                }else{
+                    startTypematic(key); // the newest key pressed becomes the typematic key
+                }
+            }
+        // else it was active, queue its release from the layer it was pressed on (unless the key is set to send no break codes)
+        }else{
+            key = KEY_MAP[(KEY_LAYERS[column] >> row) & 0x01][column][row];
+            dual = dualRole(key);
+            if( dual != DUAL_NONE ? releaseDual(dual) : ((keyAttributes(key) & KEY_NO_BREAK) || queueEvent(EVENT_BREAK | key)) ){
+                KEY_STATES[column] &= ~mask;
+                PASS_ACTIVE = 1;
+                recordRelease(position);
+                // releasing the typematic key stops repetition altogether, other keys still held do not resume repeating
+                if( TYPEMATIC_KEY == key )
+                    TYPEMATIC_KEY = K_NONE;
+            }
+        }
+#if GAMING
+        // only a change that went in locks the key out, one the queue had no room for is tried again on the next pass rather than taken for a bounce
+        if( !((KEY_STATES[column] ^ READING) & mask) )
+            lockKey(column, mask);
+#endif
+    }//end_for_rows
+    READ_COLUMN = 0xff;
+    if( column < 13 )
+        return;
+    // pass complete
+    SCAN_PASSES++;
+    updateHolds();
+    passTime = latencyStamp() - SCAN_STAMP;
+    if( passTime < SCAN_TIME_MIN )
+        SCAN_TIME_MIN = passTime;
+    if( passTime > SCAN_TIME_MAX )
+        SCAN_TIME_MAX = passTime;
+    // any key held or changed during the pass keeps the keyboard in its fast scanning mode, otherwise back off once IDLE_TIMEOUT has passed
+    if( PASS_ACTIVE ){
+        LAST_ACTIVITY = ELAPSED_TIME;
+        IDLE = 0;
+    }else if( elapsedSince(LAST_ACTIVITY) >= IDLE_TIMEOUT && !GAMING ){
+        IDLE = 1;
+    }
+}//end_debounceTask
+
+// function for the typematic task, flagging a repeat of the typematic key once REPEAT_DELAY has been met, then again at every REPEAT_RATE interval (sent once the queue has drained)
+void typematicTask(void){
+    if( TYPEMATIC_KEY != K_NONE && elapsedSince(TYPEMATIC_STAMP) >= (TYPEMATIC_REPEATING ? REPEAT_RATE : REPEAT_DELAY) ){
+        REPEAT_PENDING = 1;
+        TYPEMATIC_STAMP = ELAPSED_TIME;
+        TYPEMATIC_REPEATING = 1;
+    }
+}//end_typematicTask
+
+// function for the dual-role key task, deciding an undecided dual-role key is held once DUAL_HOLD_TIME has passed since its press
+void dualTask(void){
+    if( DUAL_PENDING != DUAL_NONE && elapsedSince(DUAL_STAMP) >= DUAL_HOLD_TIME )
+        holdDual();
+}//end_dualTask
+
+// function for the LED update task, showing LED_STATE on the lock LEDs (refreshed every interval, so nothing else writing Port 2 can leave an LED wrong for long)
+void ledTask(void){
+    // CapsLock LED (bit 2) is the only "lock-key" present on version 1.0 of this keyboard
+    // other LEDs would be: bit 0 == ScrollLock, bit 1 == NumberLock, bit 3 == International purposes (unused in US KBs)
+    P2_3 = (LED_STATE & 0x04) ? 1 : 0;
+}//end_ledTask
+
+#if TELEMETRY
+// function for the telemetry task, giving the trace a time reference often enough for its stamps to be unwrapped
+void traceTask(void){
+    TRACE(TRACE_TIME, 0);
+}//end_traceTask
+#endif
+
+// task table, in order of priority (indexed by the TASK_ definitions) with the period of each in 10ms intervals (0 to run every round)
+void (* __code TASK_FUNCTIONS[TASK_COUNT])(void) = {
+    rxTask, txTask, scanTask, debounceTask, typematicTask, dualTask, ledTask,
+#if TELEMETRY
+    traceTask,
+#endif
+};
+__code unsigned char TASK_PERIODS[TASK_COUNT] = {
+    0, 0, 0, 0, 1, 1, 1,
+#if TELEMETRY
+    TRACE_TIME_PERIOD,
+#endif
+};
+
+// function called by SDCC's startup code right after reset, before static variables are initialized, putting Port 2 in its idle state (PS/2 lines released) right away
+// (returning 0 lets the C runtime go on to initialize static variables as usual)
+unsigned char _sdcc_external_startup(void){
+    P2 = 0x0f;
+#if WATCHDOG
+    // on a watchdog reset, hand the LED state over to main() through the Timer 2 capture registers, which reset clears to 0 and nothing touches before main() reads them
+    // (RAM is about to be cleared and initialized by the C runtime)
+    if( WARM_KEY == WARM_MAGIC ){
+        RCAP2L = LED_STATE;
+        RCAP2H = 0x01;
+    }
+#endif
+    return 0;
+}//end__sdcc_external_startup
+
 // main routine
 void main(void){
-    // setup timer 2 in 16-bit auto-reload mode, and load timer registers w/ 65535 - 10000 = 55535 ===> 0xD8EF
+#if WATCHDOG
+    // pick up what _sdcc_external_startup() handed over on a watchdog reset (both 0 otherwise), before the Timer 2 reload is loaded over it
+    unsigned char warm = RCAP2H;
+    LED_STATE = RCAP2L;
+#endif
+    // setup timer 2 in 16-bit auto-reload mode, and load timer registers w/ 65536 - TICK_COUNTS (0xD8F0 at 12 MHz, 0xB1E0 at 24 MHz)
     T2CON = 0x00;
-    TL2 = 0xef;
-    TH2 = 0xd8;
+    TL2 = TIMER2_RELOAD & 0xff;
+    TH2 = TIMER2_RELOAD >> 8;
     // the following registers will hold the value to reload Timer 2 with upon overflow
-    RCAP2L = 0xef;
-    RCAP2H = 0xd8;
-// check if 24 MHz clock is defined as in use, and double Timer 2 values if so to accomodate for the faster clock speed
-#if CLOCK == 24
-    TL2 += TL2;
-    TH2 += TH2;
-    RCAP2L += RCAP2L;
-    RCAP2H += RCAP2H;
+    RCAP2L = TIMER2_RELOAD & 0xff;
+    RCAP2H = TIMER2_RELOAD >> 8;
+#if UART
+    // setup the UART in mode 1 with reception off, and Timer 1 in 8-bit auto-reload mode as its baud rate generator (the rate doubled by SMOD)
+    SCON = 0x40;
+    TMOD = (TMOD & 0x0f) | 0x20;
+    TH1 = UART_RELOAD;
+    TL1 = UART_RELOAD;
+    PCON |= SMOD;
+    TR1 = 1;
+    ES = 1;
 #endif
     // enable interrupts to occur, specifically for Timer 2 overflow to signal an interrupt
     EA = 1;
@@ -297,71 +2088,49 @@ void main(void){
     P3 = 0xff; // enable input on Port 3 from 3.0 to 3.5 (to collect columns, high-byte)
     P0 = 0x3f; // enable input on Port 0 from 0.0 to 0.5 (to collect rows)
     P2 = 0x0f; // enable output on Port 2, 2.0 as data line and 2.1 as clock. (2.2 as data monitor and 2.3 as clock monitor in external TTL design)
-    // declare array to keep track of key-presses and their timestamps, as well as counter variables and a buffer for receiving commands from host
-    unsigned char keyStamps[14][6];
-    int i = 0, j = 0, buffer = 0;
-    // main loop
+    // start the link at its fastest speed
+    LINK_HALF = LINK_HALF_TIMES[0];
+#if WATCHDOG
+    // start the watchdog, holding it while idle
+    AUXR = 0x10;
+    FEED_WATCHDOG();
+#endif
+    // run the basic assurance test (clearing the key state and checking for stuck keys), then report it once the PS/2 window for doing so has opened (straight away
+    // on a warm restart, the host having long since finished powering on)
+    selfTest();
+#if WATCHDOG
+    if( !warm )
+#endif
+    while( TICK_COUNT < BAT_DELAY )
+        FEED_WATCHDOG();
+    sendBAT();
+    BAT_TIME = TICK_COUNT;
+#if WATCHDOG
+    WARM_KEY = WARM_MAGIC;
+#endif
+    unsigned char task; // for the index of the task being run
+#if TASK_PROFILE
+    unsigned int start; // for time-stamping (with latencyStamp()) when the task running started
+#endif
+    // main loop, one scheduler round per iteration
     while(1){
-    start:
-        // check if host is attempting to communicate or inhibit communications
-        if( !(P2 & 0x02) ){
-            //P2 |= 0x20; // DEBUGGING LED (one method I sometimes employ in debugging is to have certain LEDs light under certain conditions)
-            delay_us(50);
-        // check if host is ready to transmit
-        }else if( (P2 & 0x02) && !(P2 & 0x01) ){
-            EA = 0; // disable interrupts
-            buffer = receive();
-            followCommand(buffer);
-            EA = 1; // enable interrupts
-        // otherwise, if key-matrix scanning is enabled, proceed with scanning for keypresses
-        }else if( ENABLE ){
-            //P2 |= 0x10; // DEBUGGING LED
-            // loops for checking key matrix for pressed keys, first checking Port 1 (bits 1 to 8) columns then Port 3 (bits 1 to 6) columns
-            P3 = 0x00, P1 = 0x01;
-            for(i = 0; i < 14; i++){
-                // check 0.0 to 0.5 for active/past  input
-                for(j = 0; j < 6; j++){
-                    // check if clock is being pulled low before each keyscan, as device is expected to abort scanning if host requests transmission
-                    if( !(P2 & 0x02) )
-                        goto start;
-                    // if j-th Port bit is active high, determine delay then transmit code
-                    if( P0 & (0x01 << j) ){
-                        // if the key was not priorly active, immediately transmit code
-                        if( !keyStamps[i][j] ){
-                            sendCode( KEY_SCAN_CODES[i][j], 1 );
-                            keyStamps[i][j] = ELAPSED_TIME; // update key time-stamp
-                        }
-                        // if key was active, determine if the REPEAT_DELAY has been met or already was met
-                        else if( keyStamps[i][j] >= 128 || // high bit indicates REPEAT_DELAY already was met and key is in repeating mode
-                                (ELAPSED_TIME > keyStamps[i][j] && (ELAPSED_TIME - keyStamps[i][j] >= REPEAT_DELAY)) ||
-                                (ELAPSED_TIME < keyStamps[i][j] && ((127 - keyStamps[i][j]) + ELAPSED_TIME >= REPEAT_DELAY))
-                        ){
-                            keyStamps[i][j] |= 0x80; // set the high-bit of the byte to indicate key is in repeating mode
-                            // proceed to repeat the keycode at the specified REPEAT_RATE interval
-                            if( ELAPSED_TIME % REPEAT_RATE == 0 && (keyStamps[i][j] & 0x7f) != ELAPSED_TIME ){
-                                keyStamps[i][j] = 0x80 | ELAPSED_TIME; // update key time-stamp in repeating mode
-                                sendCode( KEY_SCAN_CODES[i][j], 1 );
-                            }
-                        }
-                    // else if it was active, transmit released state
-                    }else if( keyStamps[i][j] ){
-                        sendCode( KEY_SCAN_CODES[i][j], 0 );
-                        keyStamps[i][j] = 0; // clear key time-stamp
-                    }
-                }//end_for_rows
-                // check if columns are in range of Port 1 or Port 3, shift appropriate Port accordingly
-                if(i < 7){
-                    P1 <<= 1; // shift Port 1
-                }else if(i > 7){
-                    P3 <<= 1; // shift Port 3
-                }else{
-                    // if i == 7, disable Port 1 and check Port 3 (bits 8 to 13) columns
-                    P1 = 0x00, P3 = 0x01;
-                }
-                // NOTE: SFR requires a max of 700 nano-seconds to set the Port data for valid output, which without parasitic capacitance is negligable
-                delay_us(100); // fixes potential ghost bug! (ie, parasitic capacitance in circuit causing ghost key-presses in bottom row)
-            }//end_for_columns
-        }//end_if_else
-        delay_us(50);
+        FEED_WATCHDOG();
+        for(task = 0; task < TASK_COUNT; task++){
+            if( task >= TASK_PERIODIC ){
+                if( elapsedSince(TASK_STAMPS[task - TASK_PERIODIC]) < TASK_PERIODS[task] )
+                    continue;
+                TASK_STAMPS[task - TASK_PERIODIC] = ELAPSED_TIME;
+            }
+#if TASK_PROFILE
+            start = latencyStamp();
+            TASK_FUNCTIONS[task]();
+            TASK_TIMES[task] += latencyStamp() - start;
+#else
+            TASK_FUNCTIONS[task]();
+#endif
+        }
+        // sleep until the next 10ms interval when idle between passes and the bus is free
+        if( IDLE && SCAN_COLUMN == 14 && READ_COLUMN == 0xff && (P2 & 0x03) == 0x03 )
+            sleepUntilTick();
     }//end_while
 }//end_main